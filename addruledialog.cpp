@@ -12,7 +12,7 @@ AddRuleDialog::AddRuleDialog(QWidget *parent)
     QVBoxLayout *mainLayout = new QVBoxLayout(this);
     
     m_vidPidInput = new QLineEdit(this);
-    m_vidPidInput->setPlaceholderText("VID:PID");
+    m_vidPidInput->setPlaceholderText("VID:PID, np. 0781:5567, 0781:*, 0781:5500-55ff, *:* albo port:usb1/1-3*");
     
     m_scriptPathInput = new QLineEdit(this);
     m_scriptPathInput->setPlaceholderText("Ścieżka do skryptu");
@@ -20,11 +20,24 @@ AddRuleDialog::AddRuleDialog(QWidget *parent)
     m_argsInput = new QLineEdit(this);
     m_argsInput->setPlaceholderText("Argumenty (oddzielone spacją)");
     
+    m_matchInput = new QLineEdit(this);
+    m_matchInput->setPlaceholderText("np. serial=4C53 class=08 interface_class=03 busnum=1 (opcjonalnie)");
+
     m_authCheckBox = new QCheckBox("Wymaga autoryzacji", this);
     
     m_delaySpinBox = new QSpinBox(this);
     m_delaySpinBox->setSuffix("s");
     m_delaySpinBox->setMinimum(0);
+
+    m_maxConcurrentSpinBox = new QSpinBox(this);
+    m_maxConcurrentSpinBox->setRange(0, 1024);
+    m_maxConcurrentSpinBox->setSpecialValueText("bez limitu");
+
+    m_dropOverflowCheckBox = new QCheckBox("Pomijaj ponad limit (zamiast czekać)", this);
+    m_dropOverflowCheckBox->setEnabled(false);
+    connect(m_maxConcurrentSpinBox, &QSpinBox::valueChanged, this, [this](int value) {
+        m_dropOverflowCheckBox->setEnabled(value > 0);
+    });
     
     QPushButton *browseButton = new QPushButton("Przeglądaj...", this);
     connect(browseButton, &QPushButton::clicked, this, [this](){
@@ -53,8 +66,13 @@ AddRuleDialog::AddRuleDialog(QWidget *parent)
     mainLayout->addLayout(scriptLayout);
     mainLayout->addWidget(new QLabel("Argumenty:", this));
     mainLayout->addWidget(m_argsInput);
+    mainLayout->addWidget(new QLabel("Warunki:", this));
+    mainLayout->addWidget(m_matchInput);
     mainLayout->addWidget(new QLabel("Opóźnienie:", this));
     mainLayout->addWidget(m_delaySpinBox);
+    mainLayout->addWidget(new QLabel("Maks. równolegle:", this));
+    mainLayout->addWidget(m_maxConcurrentSpinBox);
+    mainLayout->addWidget(m_dropOverflowCheckBox);
     mainLayout->addWidget(m_authCheckBox);
     mainLayout->addLayout(buttonLayout);
 }
@@ -63,11 +81,21 @@ QString AddRuleDialog::getVidPid() const {
     return m_vidPidInput->text();
 }
 
-TriggerRule AddRuleDialog::getTriggerRule() const {
-    TriggerRule rule;
-    rule.script = m_scriptPathInput->text();
-    rule.args = m_argsInput->text().split(" ", Qt::SkipEmptyParts);
-    rule.authRequired = m_authCheckBox->isChecked();
-    rule.delaySec = m_delaySpinBox->value();
-    return rule;
+ActionSpec AddRuleDialog::getAction() const {
+    ActionSpec action;
+    action.script = m_scriptPathInput->text().toStdString();
+    for (const QString& arg : m_argsInput->text().split(" ", Qt::SkipEmptyParts)) {
+        action.args.push_back(arg.toStdString());
+    }
+    action.auth_required = m_authCheckBox->isChecked();
+    action.delay_sec = m_delaySpinBox->value();
+    action.max_concurrent = m_maxConcurrentSpinBox->value();
+    action.drop_overflow = action.max_concurrent > 0 && m_dropOverflowCheckBox->isChecked();
+    for (const QString& condition : m_matchInput->text().split(" ", Qt::SkipEmptyParts)) {
+        int eq = condition.indexOf('=');
+        if (eq > 0) {
+            action.match.emplace_back(condition.left(eq).toStdString(), condition.mid(eq + 1).toStdString());
+        }
+    }
+    return action;
 }
@@ -16,14 +16,17 @@ public:
     explicit AddRuleDialog(QWidget *parent = nullptr);
 
     QString getVidPid() const;
-    TriggerRule getTriggerRule() const;
+    ActionSpec getAction() const;
 
 private:
     QLineEdit *m_vidPidInput;
     QLineEdit *m_scriptPathInput;
     QLineEdit *m_argsInput;
+    QLineEdit *m_matchInput;
     QCheckBox *m_authCheckBox;
     QSpinBox *m_delaySpinBox;
+    QSpinBox *m_maxConcurrentSpinBox;
+    QCheckBox *m_dropOverflowCheckBox;
 };
 
 #endif // ADDRULEDIALOG_H
@@ -1,22 +1,26 @@
+#include <algorithm>
+#include <chrono>
 #include <iostream>
 #include <fstream>
 #include <sstream>
-#include <map>
+#include <limits>
 #include <vector>
 #include <string>
 #include <thread>
-#include <atomic>
 #include <mutex>
-#include <chrono>
-#include <iomanip>
+#include <ctime>
+#include <cstdlib>
+#include <memory>
+#include <csignal>
+#include <sys/epoll.h>
+#include <sys/signalfd.h>
 #include <unistd.h>
-#include <sys/wait.h>
-#include <fcntl.h>
-#include <libudev.h>
-#include <nlohmann/json.hpp>
-
-using json = nlohmann::json;
-std::atomic<bool> monitoring_running(false);
+#include "core/portpath.h"
+#include "core/ruleconfig.h"
+#include "core/ruleimage.h"
+#include "core/ruletable.h"
+#include "core/ueventfilter.h"
+#include "core/usbengine.h"
 
 // Logger
 class KernelLogger {
@@ -40,206 +44,223 @@ private:
     }
 };
 
-// Trigger structure
-struct TriggerRule {
-    std::string script;
-    std::vector<std::string> args;
-    bool auth_required = false;
-    int delay_sec = 0;
-};
+// Log to stdout and the log file
+LogSink makeLogSink(KernelLogger& logger) {
+    return [&logger](const std::string& msg) {
+        static std::mutex out_mutex;
+        {
+            std::lock_guard<std::mutex> lock(out_mutex);
+            std::cout << msg << std::endl;
+        }
+        logger.log(msg);
+    };
+}
 
 // Load triggers from JSON
-std::map<std::string, std::vector<TriggerRule>> loadTriggers(const std::string& config_file) {
-    std::map<std::string, std::vector<TriggerRule>> triggers;
-    std::ifstream file(config_file);
-    if (!file.is_open()) {
-        std::cerr << "[!] Nie mozna otworzyc '" << config_file << "'." << std::endl;
-        return triggers;
-    }
-
-    try {
-        json j = json::parse(file);
-        for (auto& [vid_pid, actions] : j.items()) {
-            std::vector<TriggerRule> rules;
-            for (const auto& action : actions) {
-                TriggerRule rule;
-                rule.script = action.value("action_script", "");
-                rule.auth_required = action.value("auth_required", false);
-                rule.delay_sec = action.value("delay_sec", 0);
-                if (action.contains("action_args") && action["action_args"].is_array()) {
-                    for (const auto& arg : action["action_args"]) {
-                        rule.args.push_back(arg.get<std::string>());
-                    }
-                }
-                rules.push_back(rule);
-            }
-            triggers[vid_pid] = rules;
-        }
+RuleConfig loadTriggers(const std::string& config_file) {
+    RuleConfig triggers;
+    std::string error;
+    if (triggers.load(config_file, &error)) {
         std::cout << "[✓] Wczytano konfiguracje z '" << config_file << "'." << std::endl;
-    } catch (json::parse_error& e) {
-        std::cerr << "[!] Blad parsowania: " << e.what() << std::endl;
+    } else {
+        std::cerr << "[!] " << error << std::endl;
     }
-
     return triggers;
 }
 
 // Save triggers to JSON
-void saveTriggers(const std::string& config_file, const std::map<std::string, std::vector<TriggerRule>>& triggers) {
-    json j;
-    for (const auto& [vid_pid, rules] : triggers) {
-        json actions_array = json::array();
-        for (const auto& rule : rules) {
-            json action;
-            action["action_script"] = rule.script;
-            action["action_args"] = rule.args;
-            action["auth_required"] = rule.auth_required;
-            action["delay_sec"] = rule.delay_sec;
-            actions_array.push_back(action);
-        }
-        j[vid_pid] = actions_array;
-    }
-
-    std::ofstream file(config_file);
-    if (file.is_open()) {
-        file << std::setw(4) << j << std::endl;
+void saveTriggers(const std::string& config_file, const RuleConfig& triggers) {
+    std::string error;
+    if (triggers.save(config_file, &error)) {
         std::cout << "[✓] Zapisano konfiguracje do '" << config_file << "'." << std::endl;
     } else {
-        std::cerr << "[!] Blad zapisu do '" << config_file << "'." << std::endl;
+        std::cerr << "[!] Blad zapisu: " << error << std::endl;
     }
 }
 
-// Execute script
-void executeScriptWithDelay(const TriggerRule& rule, KernelLogger& logger) {
-    if (access(rule.script.c_str(), X_OK) != 0) {
-        logger.log("[X] Skrypt '" + rule.script + "' nie jest wykonalny.");
-        return;
+// Compile triggers.json into a binary rule image
+int compileRuleImage(const std::string& config_file, const std::string& image_file) {
+    RuleImage::SourceStamp stamp;
+    if (!RuleImage::stampOf(config_file, stamp)) {
+        std::cerr << "[!] Nie mozna otworzyc '" << config_file << "'." << std::endl;
+        return 1;
     }
-
-    if (rule.delay_sec > 0) {
-        logger.log("[•] Opóźnienie " + std::to_string(rule.delay_sec) + "s dla '" + rule.script + "'");
-        std::this_thread::sleep_for(std::chrono::seconds(rule.delay_sec));
+    std::string error;
+    std::shared_ptr<const RuleTable> rules = RuleTable::fromFile(config_file, &error);
+    if (!rules) {
+        std::cerr << "[!] Blad wczytywania konfiguracji: " << error << std::endl;
+        return 1;
     }
-
-    pid_t pid = fork();
-    if (pid == -1) {
-        logger.log("[!] fork() nie powiodlo sie.");
-        return;
+    if (!RuleImage::write(*rules, stamp, image_file, &error)) {
+        std::cerr << "[!] " << error << std::endl;
+        return 1;
     }
+    std::cout << "[✓] Skompilowano " << rules->actionCount() << " akcji dla " << rules->keyCount()
+              << " regul do '" << image_file << "' (" << rules->memoryUsage() << " B)." << std::endl;
+    return 0;
+}
 
-    if (pid == 0) {
-        std::vector<char*> argv_vec;
-        argv_vec.push_back(const_cast<char*>(rule.script.c_str()));
-        for (const auto& arg : rule.args) {
-            argv_vec.push_back(const_cast<char*>(arg.c_str()));
-        }
-        argv_vec.push_back(nullptr);
-
-        int devnull = open("/dev/null", O_WRONLY);
-        if (devnull != -1) {
-            dup2(devnull, STDOUT_FILENO);
-            dup2(devnull, STDERR_FILENO);
-            close(devnull);
-        }
-
-        execvp(rule.script.c_str(), argv_vec.data());
-        perror("execvp");
-        exit(1);
-    } else {
-        int status;
-        waitpid(pid, &status, 0);
-        if (WIFEXITED(status) && WEXITSTATUS(status) == 0) {
-            logger.log("[✓] Akcja '" + rule.script + "' zakonczona sukcesem.");
-        } else {
-            logger.log("[X] Akcja '" + rule.script + "' blad. Kod: " + std::to_string(WEXITSTATUS(status)));
-        }
+// Builds the socket filter for the config and runs every check on it
+int checkSocketFilter(const std::string& config_file) {
+    std::string error;
+    std::shared_ptr<const RuleTable> rules = RuleTable::fromFile(config_file, &error);
+    if (!rules) {
+        std::cerr << "[!] Blad wczytywania konfiguracji: " << error << std::endl;
+        return 1;
     }
+    UeventFilter filter;
+    if (!filter.compile(*rules, &error)) {
+        std::cout << "[•] Bez filtra gniazda: " << error << "." << std::endl;
+        return 0;
+    }
+    if (!filter.verify(&error)) {
+        std::cerr << "[!] Filtr gniazda: " << error << "." << std::endl;
+        return 1;
+    }
+    std::cout << "[✓] Filtr gniazda: " << filter.patternCount() << " wzorcow VID:PID, " << filter.size()
+              << " instrukcji, okno " << filter.window() << " B - sprawdzony." << std::endl;
+    return 0;
 }
 
-// Monitor USB
-void monitorUsbEvents(const std::string& config_file) {
-    KernelLogger logger;
-    std::cout << "[•] Monitoring zdarzen USB z '" << config_file << "'." << std::endl;
-
-    struct udev* udev = udev_new();
-    if (!udev) {
-        logger.log("[!] Nie mozna utworzyc kontekstu udev.");
-        return;
+// One line per plugged-in device: VID:PID, port, serial, SEQNUM, attach time
+std::vector<std::string> formatAttachedDevices(const DeviceRegistry& registry) {
+    std::vector<std::string> lines;
+    for (const AttachedDevice& device : registry.snapshot()) {
+        char vid_pid[10];
+        const char* port = findPortPath(device.devpath.c_str());
+        std::time_t attached = std::chrono::system_clock::to_time_t(device.attached);
+        char when[32];
+        std::strftime(when, sizeof(when), "%Y-%m-%d %H:%M:%S", std::localtime(&attached));
+        lines.push_back(std::string(device.key ? formatUsbKey(device.key, vid_pid) : "?") + " port "
+                        + (port ? port : device.devpath.c_str()) + " serial "
+                        + (device.serial.empty() ? "?" : device.serial) + " seqnum "
+                        + std::to_string(device.seqnum) + " od " + when);
     }
+    std::sort(lines.begin(), lines.end());
+    return lines;
+}
 
-    struct udev_monitor* mon = udev_monitor_new_from_netlink(udev, "udev");
-    if (!mon) {
-        logger.log("[!] Nie mozna utworzyc monitora udev.");
-        udev_unref(udev);
+// Daemon signals, handled in the engine's event loop: SIGINT/SIGTERM stop
+// it, SIGUSR1 logs the uevent batch-size histogram and the overflow count,
+// SIGUSR2 the devices that are plugged in
+void watchDaemonSignals(UsbEngine& engine, const LogSink& log) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGINT);
+    sigaddset(&mask, SIGTERM);
+    sigaddset(&mask, SIGUSR1);
+    sigaddset(&mask, SIGUSR2);
+    if (sigprocmask(SIG_BLOCK, &mask, nullptr) != 0) {
         return;
     }
-
-    udev_monitor_filter_add_match_subsystem_devtype(mon, "usb", "usb_device");
-    udev_monitor_enable_receiving(mon);
-    int fd = udev_monitor_get_fd(mon);
-
-    while (monitoring_running) {
-        fd_set fds;
-        FD_ZERO(&fds);
-        FD_SET(fd, &fds);
-        struct timeval tv = {0, 100000};
-        select(fd + 1, &fds, NULL, NULL, &tv);
-
-        if (FD_ISSET(fd, &fds)) {
-            struct udev_device* dev = udev_monitor_receive_device(mon);
-            if (dev) {
-                const char* action = udev_device_get_action(dev);
-                if (action && std::string(action) == "add") {
-                    const char* vendor_id = udev_device_get_sysattr_value(dev, "idVendor");
-                    const char* product_id = udev_device_get_sysattr_value(dev, "idProduct");
-                    if (vendor_id && product_id) {
-                        std::string vid_pid = std::string(vendor_id) + ":" + std::string(product_id);
-                        const char* product = udev_device_get_sysattr_value(dev, "product");
-                        const char* manufacturer = udev_device_get_sysattr_value(dev, "manufacturer");
-                        std::string device_name = (manufacturer && product) ?
-                            std::string(manufacturer) + " " + std::string(product) :
-                            "nieznane urzadzenie";
-
-                        std::cout << "\n[+] Wykryto: " << device_name << " (" << vid_pid << ")" << std::endl;
-                        auto triggers = loadTriggers(config_file);
-                        if (triggers.count(vid_pid)) {
-                            std::cout << "  [•] Akcje: " << triggers[vid_pid].size() << std::endl;
-                            for (const auto& rule : triggers[vid_pid]) {
-                                executeScriptWithDelay(rule, logger);
-                            }
-                        } else {
-                            std::cout << "  [•] Brak akcji dla " << vid_pid << "." << std::endl;
-                        }
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd < 0 || !engine.reactor().add(fd, EPOLLIN, [fd, &engine, log](uint32_t) {
+            struct signalfd_siginfo info;
+            while (read(fd, &info, sizeof(info)) == ssize_t(sizeof(info))) {
+                if (info.ssi_signo == SIGUSR1) {
+                    log("[•] Rozmiary paczek zdarzeń: " + engine.batchSizes().format() + ", przepełnienia bufora: "
+                        + std::to_string(engine.overflowCount()));
+                } else if (info.ssi_signo == SIGUSR2) {
+                    std::vector<std::string> lines = formatAttachedDevices(engine.devices());
+                    log("[•] Podłączone urządzenia: " + std::to_string(lines.size()));
+                    for (const std::string& line : lines) {
+                        log("  " + line);
                     }
+                } else {
+                    engine.stop();
                 }
-                udev_device_unref(dev);
             }
-        }
+        })) {
+        sigprocmask(SIG_UNBLOCK, &mask, nullptr);
+        if (fd >= 0) close(fd);
     }
+}
 
-    udev_monitor_unref(mon);
-    udev_unref(udev);
+// Parse a byte count with an optional K/M suffix
+bool parseByteSize(const std::string& text, int& out) {
+    char* end = nullptr;
+    unsigned long value = strtoul(text.c_str(), &end, 10);
+    if (end == text.c_str()) {
+        return false;
+    }
+    std::string suffix(end);
+    if (suffix == "K" || suffix == "k") {
+        value <<= 10;
+    } else if (suffix == "M" || suffix == "m") {
+        value <<= 20;
+    } else if (!suffix.empty()) {
+        return false;
+    }
+    if (value > (1ul << 30)) {
+        return false;
+    }
+    out = int(value);
+    return true;
 }
 
 // CLI usage
 void usage(const std::string& name) {
-    std::cout << "Uzycie: " << name << " [--config <plik>] [--daemon] [--help]" << std::endl;
+    std::cout << "Uzycie: " << name << " [--config <plik>] [--image <plik.bin>] [--rcvbuf <bajty>[K|M]] [--source udev|kernel] [--no-filter] [--sysfs-scan] [--coldplug] [--max-concurrent <n>] [--daemon] [--help]" << std::endl;
+    std::cout << "       " << name << " --compile <plik.json> [-o <plik.bin>]" << std::endl;
+    std::cout << "       " << name << " --check-filter [--config <plik>]" << std::endl;
 }
 
 // Main
 int main(int argc, char* argv[]) {
-    if (getuid() != 0) {
-        std::cerr << "[!] you are not root." << std::endl;
-        return 1;
-    }
-
     std::string config_file = "triggers.json";
+    std::string image_file;
+    std::string compile_file;
+    std::string output_file;
+    int receive_buffer = UsbEngine::kDefaultReceiveBuffer;
+    UsbEngine::Source source = UsbEngine::Udev;
+    bool socket_filter = true;
+    bool sysfs_scan = false;
+    bool coldplug = false;
+    unsigned long max_concurrent = ActionDispatcher::kDefaultMaxConcurrent;
     bool run_as_daemon = false;
     bool show_help = false;
+    bool check_filter = false;
 
     for (int i = 1; i < argc; ++i) {
         std::string arg = argv[i];
         if (arg == "--config" && i + 1 < argc) {
             config_file = argv[++i];
+        } else if (arg == "--image" && i + 1 < argc) {
+            image_file = argv[++i];
+        } else if (arg == "--rcvbuf" && i + 1 < argc) {
+            if (!parseByteSize(argv[++i], receive_buffer)) {
+                std::cerr << "[!] Nieprawidlowy rozmiar bufora: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--source" && i + 1 < argc) {
+            std::string value = argv[++i];
+            if (value == "udev") {
+                source = UsbEngine::Udev;
+            } else if (value == "kernel") {
+                source = UsbEngine::Kernel;
+            } else {
+                std::cerr << "[!] Nieznane zrodlo zdarzen: " << value << std::endl;
+                return 1;
+            }
+        } else if (arg == "--no-filter") {
+            socket_filter = false;
+        } else if (arg == "--sysfs-scan") {
+            sysfs_scan = true;
+        } else if (arg == "--coldplug") {
+            coldplug = true;
+        } else if (arg == "--max-concurrent" && i + 1 < argc) {
+            char* end = nullptr;
+            max_concurrent = strtoul(argv[++i], &end, 10);
+            if (end == argv[i] || *end != '\0') {
+                std::cerr << "[!] Nieprawidlowy limit akcji: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--compile" && i + 1 < argc) {
+            compile_file = argv[++i];
+        } else if (arg == "--check-filter") {
+            check_filter = true;
+        } else if (arg == "-o" && i + 1 < argc) {
+            output_file = argv[++i];
         } else if (arg == "--daemon") {
             run_as_daemon = true;
         } else if (arg == "--help") {
@@ -256,11 +277,40 @@ int main(int argc, char* argv[]) {
         return 0;
     }
 
+    if (!compile_file.empty()) {
+        return compileRuleImage(compile_file, output_file.empty() ? RuleImage::defaultPathFor(compile_file) : output_file);
+    }
+
+    if (check_filter) {
+        return checkSocketFilter(config_file);
+    }
+
+    if (getuid() != 0) {
+        std::cerr << "[!] you are not root." << std::endl;
+        return 1;
+    }
+
+    if (image_file.empty()) {
+        image_file = RuleImage::defaultPathFor(config_file);
+    }
+
+    KernelLogger logger;
+    LogSink log = makeLogSink(logger);
+    UsbEngine engine(ActionDispatcher::Wait, log);
+    engine.setConfigPath(config_file, image_file);
+    engine.setReceiveBufferSize(receive_buffer);
+    engine.setSource(source);
+    engine.setSocketFilter(socket_filter);
+    engine.setSysfsScan(sysfs_scan);
+    engine.setColdplug(coldplug);
+    engine.setMaxConcurrent(max_concurrent);
+
     if (run_as_daemon) {
-        monitoring_running = true;
-        monitorUsbEvents(config_file);
+        watchDaemonSignals(engine, log);
+        return engine.run() ? 0 : 1;
     } else {
-        std::map<std::string, std::vector<TriggerRule>> triggers = loadTriggers(config_file);
+        RuleConfig triggers = loadTriggers(config_file);
+        std::thread monitor_thread;
         std::string choice;
         while (true) {
             std::cout << "\n### Autotriggers Menu ###" << std::endl;
@@ -271,28 +321,34 @@ int main(int argc, char* argv[]) {
             std::cout << "5. Stop monitoring" << std::endl;
             std::cout << "6. Zapisz konfiguracje" << std::endl;
             std::cout << "7. Wyjdz" << std::endl;
+            std::cout << "8. Pokaz podlaczone urzadzenia" << std::endl;
             std::cout << "Wybierz opcje: ";
             std::cin >> choice;
             std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
 
             if (choice == "1") {
-                for (const auto& [vid_pid, rules] : triggers) {
+                for (const auto& [vid_pid, rules] : triggers.entries()) {
                     std::cout << "\n[" << vid_pid << "]" << std::endl;
                     for (size_t i = 0; i < rules.size(); ++i) {
                         const auto& rule = rules[i];
                         std::cout << "  #" << i + 1 << ": " << rule.script << " ";
                         for (const auto& arg : rule.args) std::cout << arg << " ";
                         std::cout << "| auth: " << (rule.auth_required ? "Tak" : "Nie");
-                        std::cout << " | delay: " << rule.delay_sec << "s" << std::endl;
+                        std::cout << " | delay: " << rule.delay_sec << "s";
+                        if (rule.max_concurrent > 0) {
+                            std::cout << " | max: " << rule.max_concurrent << (rule.drop_overflow ? " (drop)" : "");
+                        }
+                        for (const auto& [attr, value] : rule.match) std::cout << " | " << attr << "=" << value;
+                        std::cout << std::endl;
                     }
                 }
             } else if (choice == "2") {
                 std::string vid_pid;
-                std::cout << "VID:PID: ";
+                std::cout << "VID:PID lub port:<sciezka>: ";
                 std::cin >> vid_pid;
                 std::cin.ignore();
 
-                TriggerRule rule;
+                ActionSpec rule;
                 std::cout << "Sciezka do skryptu: ";
                 std::getline(std::cin, rule.script);
 
@@ -311,29 +367,51 @@ int main(int argc, char* argv[]) {
                 std::cout << "Opóźnienie (s): ";
                 std::cin >> rule.delay_sec;
 
-                triggers[vid_pid].push_back(rule);
+                std::cout << "Maks. rownolegle (0 = bez limitu): ";
+                std::cin >> rule.max_concurrent;
+                if (rule.max_concurrent > 0) {
+                    std::cout << "Ponad limit: pomin zamiast czekac (tak/nie): ";
+                    std::string drop;
+                    std::cin >> drop;
+                    rule.drop_overflow = (drop == "tak");
+                }
+                std::cin.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+
+                std::cout << "Warunki (atrybut=wartosc, np. serial=123 class=08; Enter = brak): ";
+                std::string match_line;
+                std::getline(std::cin, match_line);
+                std::stringstream ms(match_line);
+                std::string condition;
+                while (ms >> condition) {
+                    size_t eq = condition.find('=');
+                    if (eq != std::string::npos) {
+                        rule.match.emplace_back(condition.substr(0, eq), condition.substr(eq + 1));
+                    }
+                }
+
+                triggers.add(vid_pid, rule);
                 std::cout << "[✓] Dodano trigger dla " << vid_pid << std::endl;
             } else if (choice == "3") {
                 std::string vid_pid;
                 std::cout << "VID:PID do usuniecia: ";
                 std::cin >> vid_pid;
-                if (triggers.erase(vid_pid)) {
+                if (triggers.remove(vid_pid)) {
                     std::cout << "[✓] Usunieto trigger dla " << vid_pid << std::endl;
                 } else {
                     std::cout << "[!] Nie znaleziono " << vid_pid << std::endl;
                 }
             } else if (choice == "4") {
-                if (!monitoring_running) {
-                    monitoring_running = true;
-                    std::thread monitor_thread(monitorUsbEvents, config_file);
-                    monitor_thread.detach();
+                if (!monitor_thread.joinable()) {
+                    engine.resetStop();
+                    monitor_thread = std::thread([&engine]() { engine.run(); });
                     std::cout << "[✓] Monitoring uruchomiony." << std::endl;
                 } else {
                     std::cout << "[!] Monitoring juz dziala." << std::endl;
                 }
             } else if (choice == "5") {
-                if (monitoring_running) {
-                    monitoring_running = false;
+                if (monitor_thread.joinable()) {
+                    engine.stop();
+                    monitor_thread.join();
                     std::cout << "[✓] Monitoring zatrzymany." << std::endl;
                 } else {
                     std::cout << "[!] Monitoring nie byl aktywny." << std::endl;
@@ -341,8 +419,22 @@ int main(int argc, char* argv[]) {
             } else if (choice == "6") {
                 saveTriggers(config_file, triggers);
             } else if (choice == "7") {
+                if (monitor_thread.joinable()) {
+                    engine.stop();
+                    monitor_thread.join();
+                }
                 std::cout << "[✓] Zakonczono." << std::endl;
                 break;
+            } else if (choice == "8") {
+                if (!monitor_thread.joinable()) {
+                    std::cout << "[!] Monitoring nie jest aktywny." << std::endl;
+                } else {
+                    std::vector<std::string> lines = formatAttachedDevices(engine.devices());
+                    std::cout << "Podlaczone urzadzenia: " << lines.size() << std::endl;
+                    for (const std::string& line : lines) {
+                        std::cout << "  " << line << std::endl;
+                    }
+                }
             } else {
                 std::cout << "[!] Nieprawidlowa opcja." << std::endl;
             }
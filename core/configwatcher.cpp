@@ -0,0 +1,63 @@
+#include "configwatcher.h"
+#include <sys/inotify.h>
+#include <unistd.h>
+
+ConfigWatcher::ConfigWatcher(const std::string& path)
+    : m_fd(inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) {
+    addFile(path);
+}
+
+ConfigWatcher::~ConfigWatcher() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool ConfigWatcher::addFile(const std::string& path) {
+    if (m_fd < 0) {
+        return false;
+    }
+
+    std::string dir = ".";
+    std::string fileName = path;
+    size_t slash = path.find_last_of('/');
+    if (slash != std::string::npos) {
+        dir = slash == 0 ? "/" : path.substr(0, slash);
+        fileName = path.substr(slash + 1);
+    }
+
+    int wd = inotify_add_watch(m_fd, dir.c_str(),
+                               IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE);
+    if (wd < 0) {
+        return false;
+    }
+    m_watches.push_back(Watch{wd, fileName});
+    return true;
+}
+
+bool ConfigWatcher::consumeChanges() {
+    if (m_fd < 0) {
+        return false;
+    }
+
+    alignas(struct inotify_event) char buf[4096];
+    bool changed = false;
+    for (;;) {
+        ssize_t len = read(m_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            break;
+        }
+        for (char* p = buf; p < buf + len;) {
+            auto* ev = reinterpret_cast<struct inotify_event*>(p);
+            if (ev->len > 0) {
+                for (const Watch& watch : m_watches) {
+                    if (watch.wd == ev->wd && watch.fileName == ev->name) {
+                        changed = true;
+                    }
+                }
+            }
+            p += sizeof(struct inotify_event) + ev->len;
+        }
+    }
+    return changed;
+}
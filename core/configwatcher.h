@@ -0,0 +1,37 @@
+#ifndef CONFIGWATCHER_H
+#define CONFIGWATCHER_H
+
+#include <string>
+#include <vector>
+
+// inotify watch on the directory holding the config file, so editors that
+// save via rename are picked up as well as in-place writes.
+class ConfigWatcher {
+public:
+    explicit ConfigWatcher(const std::string& path);
+    ~ConfigWatcher();
+
+    ConfigWatcher(const ConfigWatcher&) = delete;
+    ConfigWatcher& operator=(const ConfigWatcher&) = delete;
+
+    // Also reports changes of another file (e.g. the precompiled rule image).
+    bool addFile(const std::string& path);
+
+    bool isValid() const { return !m_watches.empty(); }
+    int fd() const { return m_fd; }
+
+    // Drains all pending inotify events. Returns true if any of them
+    // concerned a watched file.
+    bool consumeChanges();
+
+private:
+    struct Watch {
+        int wd;
+        std::string fileName;
+    };
+
+    int m_fd;
+    std::vector<Watch> m_watches;
+};
+
+#endif // CONFIGWATCHER_H
@@ -0,0 +1,172 @@
+#ifndef DEVICEATTRS_H
+#define DEVICEATTRS_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include "usbkey.h"
+
+// Device attributes a rule can test besides VID:PID ("match" in triggers.json).
+enum class DeviceAttr : uint8_t {
+    BusNum,
+    DeviceClass,
+    InterfaceClass,
+    Manufacturer,
+    Product,
+    Serial,
+    Count
+};
+
+const size_t kDeviceAttrCount = size_t(DeviceAttr::Count);
+
+inline const char* deviceAttrName(DeviceAttr attr) {
+    static const char* const names[kDeviceAttrCount] = {
+        "busnum", "class", "interface_class", "manufacturer", "product", "serial"
+    };
+    return names[size_t(attr)];
+}
+
+inline bool parseDeviceAttr(const std::string& name, DeviceAttr& out) {
+    for (size_t i = 0; i < kDeviceAttrCount; ++i) {
+        if (name == deviceAttrName(DeviceAttr(i))) {
+            out = DeviceAttr(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// An interface class is tested against every interface of the device.
+inline bool deviceAttrIsMultiValued(DeviceAttr attr) {
+    return attr == DeviceAttr::InterfaceClass;
+}
+
+// Canonical form of a rule value, so it compares equal to what sysfs reports:
+// classes as two lowercase hex digits ("08"), busnum in decimal without padding,
+// strings unchanged.
+inline bool normalizeAttrValue(DeviceAttr attr, const std::string& text, std::string& out) {
+    char buf[8];
+    switch (attr) {
+    case DeviceAttr::DeviceClass:
+    case DeviceAttr::InterfaceClass: {
+        const char* s = text.c_str();
+        const char* end = s + text.size();
+        if (end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+            s += 2;
+        }
+        uint16_t value;
+        if (end - s > 2 || !parseUsbId(s, end, value)) {
+            return false;
+        }
+        std::snprintf(buf, sizeof(buf), "%02x", value);
+        out = buf;
+        return true;
+    }
+    case DeviceAttr::BusNum: {
+        if (text.empty() || text.size() > 3) {
+            return false;
+        }
+        unsigned value = 0;
+        for (char c : text) {
+            if (c < '0' || c > '9') {
+                return false;
+            }
+            value = value * 10 + unsigned(c - '0');
+        }
+        std::snprintf(buf, sizeof(buf), "%u", value);
+        out = buf;
+        return true;
+    }
+    default:
+        out = text;
+        return true;
+    }
+}
+
+// Text of a numeric JSON value: classes are numbers in their own right
+// (8 == "08"), anything else is taken as decimal.
+inline std::string formatAttrNumber(const std::string& name, unsigned long long value) {
+    DeviceAttr attr;
+    bool hex = parseDeviceAttr(name, attr) && (attr == DeviceAttr::DeviceClass || attr == DeviceAttr::InterfaceClass);
+    char buf[24];
+    std::snprintf(buf, sizeof(buf), hex ? "%llx" : "%llu", value);
+    return buf;
+}
+
+// Calls f(value) for each value of a raw attribute. Single-valued attributes
+// have one; the interface class comes from ID_USB_INTERFACES (":080650:030101:")
+// and yields the distinct class bytes. Stops early when f returns false.
+template <typename F>
+void forEachAttrValue(DeviceAttr attr, const char* raw, F&& f) {
+    if (!raw) {
+        return;
+    }
+    if (!deviceAttrIsMultiValued(attr)) {
+        f(raw);
+        return;
+    }
+    char seen[32][3];
+    size_t count = 0;
+    for (const char* p = raw; *p; ) {
+        if (*p == ':') {
+            ++p;
+            continue;
+        }
+        const char* end = p;
+        while (*end && *end != ':') {
+            ++end;
+        }
+        if (end - p == 6 && hexDigitValue(p[0]) >= 0 && hexDigitValue(p[1]) >= 0) {
+            char cls[3] = {char(p[0] | 0x20), char(p[1] | 0x20), '\0'};
+            bool duplicate = false;
+            for (size_t i = 0; i < count && !duplicate; ++i) {
+                duplicate = memcmp(seen[i], cls, 3) == 0;
+            }
+            if (!duplicate && count < 32) {
+                memcpy(seen[count++], cls, 3);
+                if (!f(static_cast<const char*>(seen[count - 1]))) {
+                    return;
+                }
+            }
+        }
+        p = end;
+    }
+}
+
+// Per-event attribute cache. Each attribute is fetched from the device only
+// when first asked for, and at most once.
+class DeviceAttrs {
+public:
+    virtual ~DeviceAttrs() = default;
+
+    const char* get(DeviceAttr attr) {
+        uint32_t bit = 1u << unsigned(attr);
+        if (!(m_fetched & bit)) {
+            m_values[size_t(attr)] = fetch(attr);
+            m_fetched |= bit;
+        }
+        return m_values[size_t(attr)];
+    }
+
+    // Bit per DeviceAttr that has been read so far.
+    uint32_t fetchedMask() const { return m_fetched; }
+
+    // "manufacturer product" for logs, empty if either is missing. Sources
+    // whose events carry the names override this to skip sysfs.
+    virtual std::string displayName() {
+        const char* manufacturer = get(DeviceAttr::Manufacturer);
+        const char* product = get(DeviceAttr::Product);
+        return (manufacturer && product) ? std::string(manufacturer) + " " + product : std::string();
+    }
+
+protected:
+    // Returns nullptr when the device doesn't have the attribute.
+    virtual const char* fetch(DeviceAttr attr) = 0;
+
+private:
+    const char* m_values[kDeviceAttrCount] = {};
+    uint32_t m_fetched = 0;
+};
+
+#endif // DEVICEATTRS_H
@@ -0,0 +1,169 @@
+#include "deviceregistry.h"
+#include <algorithm>
+#include <utility>
+
+void DeviceRegistry::setListener(Listener listener) {
+    m_listener = std::move(listener);
+}
+
+void DeviceRegistry::link(const AttachedDevice& device) {
+    m_byKey[device.key].push_back(&device);
+}
+
+void DeviceRegistry::unlink(const AttachedDevice& device) {
+    auto bucket = m_byKey.find(device.key);
+    if (bucket == m_byKey.end()) {
+        return;
+    }
+    std::vector<const AttachedDevice*>& devices = bucket->second;
+    devices.erase(std::remove(devices.begin(), devices.end(), &device), devices.end());
+    if (devices.empty()) {
+        m_byKey.erase(bucket);
+    }
+}
+
+void DeviceRegistry::notify() {
+    if (m_listener) {
+        m_listener();
+    }
+}
+
+bool DeviceRegistry::add(AttachedDevice device) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_byPath.find(device.devpath);
+        if (it != m_byPath.end()) {
+            if (it->second.devnum == device.devnum) {
+                return false;
+            }
+            unlink(it->second);
+            it->second = std::move(device);
+        } else {
+            std::string devpath = device.devpath;
+            it = m_byPath.emplace(std::move(devpath), std::move(device)).first;
+        }
+        link(it->second);
+    }
+    notify();
+    return true;
+}
+
+bool DeviceRegistry::change(const std::string& devpath, uint64_t seqnum, const std::string& serial) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_byPath.find(devpath);
+        if (it == m_byPath.end()) {
+            return false;
+        }
+        if (seqnum != 0) {
+            it->second.seqnum = seqnum;
+        }
+        if (!serial.empty()) {
+            it->second.serial = serial;
+        }
+    }
+    notify();
+    return true;
+}
+
+bool DeviceRegistry::remove(const std::string& devpath, dev_t devnum) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_byPath.find(devpath);
+        if (it == m_byPath.end() || (devnum != 0 && it->second.devnum != devnum)) {
+            return false;
+        }
+        unlink(it->second);
+        m_byPath.erase(it);
+    }
+    notify();
+    return true;
+}
+
+size_t DeviceRegistry::replace(std::vector<AttachedDevice> devices) {
+    size_t dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        std::unordered_map<std::string, AttachedDevice> present;
+        present.reserve(devices.size());
+        for (AttachedDevice& device : devices) {
+            auto known = m_byPath.find(device.devpath);
+            if (known != m_byPath.end() && known->second.devnum == device.devnum) {
+                present.emplace(device.devpath, std::move(known->second));
+                m_byPath.erase(known);
+            } else {
+                std::string devpath = device.devpath;
+                present.emplace(std::move(devpath), std::move(device));
+            }
+        }
+        dropped = m_byPath.size();
+        m_byPath.swap(present);
+        m_byKey.clear();
+        for (const auto& entry : m_byPath) {
+            link(entry.second);
+        }
+    }
+    notify();
+    return dropped;
+}
+
+void DeviceRegistry::clear() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (m_byPath.empty()) {
+            return;
+        }
+        m_byPath.clear();
+        m_byKey.clear();
+    }
+    notify();
+}
+
+bool DeviceRegistry::contains(const std::string& devpath, dev_t devnum) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_byPath.find(devpath);
+    return it != m_byPath.end() && it->second.devnum == devnum;
+}
+
+bool DeviceRegistry::find(const std::string& devpath, AttachedDevice& out) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_byPath.find(devpath);
+    if (it == m_byPath.end()) {
+        return false;
+    }
+    out = it->second;
+    return true;
+}
+
+std::vector<AttachedDevice> DeviceRegistry::findByKey(uint32_t key) const {
+    std::vector<AttachedDevice> out;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto bucket = m_byKey.find(key);
+    if (bucket != m_byKey.end()) {
+        for (const AttachedDevice* device : bucket->second) {
+            out.push_back(*device);
+        }
+    }
+    return out;
+}
+
+size_t DeviceRegistry::countByKey(uint32_t key) const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto bucket = m_byKey.find(key);
+    return bucket == m_byKey.end() ? 0 : bucket->second.size();
+}
+
+std::vector<AttachedDevice> DeviceRegistry::snapshot() const {
+    std::vector<AttachedDevice> out;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    out.reserve(m_byPath.size());
+    for (const auto& entry : m_byPath) {
+        out.push_back(entry.second);
+    }
+    return out;
+}
+
+size_t DeviceRegistry::size() const {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_byPath.size();
+}
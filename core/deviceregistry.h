@@ -0,0 +1,68 @@
+#ifndef DEVICEREGISTRY_H
+#define DEVICEREGISTRY_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <unordered_map>
+#include <vector>
+
+// A plugged-in device instance. devpath plus devnum identify it: the device
+// number changes on every plug, the devpath only with the port.
+struct AttachedDevice {
+    std::string devpath;
+    uint32_t key = 0;               // VID:PID, 0 if the device has none
+    dev_t devnum = 0;
+    std::string serial;             // empty if not known without reading sysfs
+    uint64_t seqnum = 0;            // of the last add/change, 0 if enumerated
+    std::chrono::system_clock::time_point attached;
+};
+
+// The devices currently plugged in, by devpath and by VID:PID, both O(1).
+// Updated by the monitoring thread from add/remove/change events, read
+// from any thread (GUI, control interface). Records are copied out, so a
+// reader never holds the lock beyond the call.
+class DeviceRegistry {
+public:
+    // Called on the writing thread after each change, without the lock held.
+    using Listener = std::function<void()>;
+    void setListener(Listener listener);
+
+    // False if the same instance is already registered. Another instance
+    // at the same devpath is replaced.
+    bool add(AttachedDevice device);
+    // A "change", or a serial learned later; seqnum 0 and an empty serial
+    // leave the field as it is. False if no instance is at devpath.
+    bool change(const std::string& devpath, uint64_t seqnum, const std::string& serial);
+    // False if devpath holds no instance or one with another devnum (the
+    // event is about an older instance). devnum 0 matches any.
+    bool remove(const std::string& devpath, dev_t devnum);
+    // Replaces the whole set with what an enumeration found; instances that
+    // are still there keep their records. Returns how many were dropped.
+    size_t replace(std::vector<AttachedDevice> devices);
+    void clear();
+
+    bool contains(const std::string& devpath, dev_t devnum) const;
+    bool find(const std::string& devpath, AttachedDevice& out) const;
+    std::vector<AttachedDevice> findByKey(uint32_t key) const;
+    size_t countByKey(uint32_t key) const;
+    std::vector<AttachedDevice> snapshot() const;
+    size_t size() const;
+
+private:
+    void link(const AttachedDevice& device);
+    void unlink(const AttachedDevice& device);
+    void notify();
+
+    mutable std::mutex m_mutex;
+    // Nodes of an unordered_map don't move, so m_byKey can point into it.
+    std::unordered_map<std::string, AttachedDevice> m_byPath;
+    std::unordered_map<uint32_t, std::vector<const AttachedDevice*>> m_byKey;
+    Listener m_listener;            // set before run(), read without the lock
+};
+
+#endif // DEVICEREGISTRY_H
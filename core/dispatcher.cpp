@@ -0,0 +1,672 @@
+#include "dispatcher.h"
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <csignal>
+#include <cstring>
+#include <iterator>
+#include <string_view>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_set>
+#include <vector>
+
+namespace {
+
+const size_t kInlineArgs = 32;
+
+int waitChild(pid_t pid) {
+    int status = 0;
+    while (waitpid(pid, &status, 0) < 0) {
+        if (errno != EINTR) {
+            return -1;
+        }
+    }
+    return status;
+}
+
+// Milliseconds of CLOCK_MONOTONIC, the timerfd's clock.
+uint64_t monotonicMs() {
+    return uint64_t(std::chrono::duration_cast<std::chrono::milliseconds>(
+                        std::chrono::steady_clock::now().time_since_epoch())
+                        .count());
+}
+
+// Identifies an action across reloads: its group's fingerprint and its
+// position in the group.
+uint64_t actionSlot(const RuleMatch& match, const CompiledAction& action) {
+    return match.fingerprint ^ (uint64_t(&action - match.actions.begin()) + 1) * 0x9e3779b97f4a7c15ull;
+}
+
+uint64_t deviceStrand(std::string_view devpath) {
+    if (devpath.empty()) {
+        return 0;
+    }
+    uint64_t strand = std::hash<std::string_view>()(devpath);
+    return strand ? strand : 1;
+}
+
+} // namespace
+
+ActionDispatcher::ActionDispatcher(Mode mode, LogSink log)
+    : m_mode(mode),
+      m_log(std::move(log)),
+      m_timerFd(timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)),
+      m_wakeFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      m_tracked(ProcessSupervisor::isSupported()),
+      m_wheel(monotonicMs()) {
+    if (m_timerFd < 0 || m_wakeFd < 0 || !m_ownLoop.isValid()) {
+        m_log("[!] Brak timerfd/eventfd - opóźnienia i limity akcji nie będą uwzględniane.");
+        if (m_timerFd >= 0) {
+            close(m_timerFd);
+            m_timerFd = -1;
+        }
+    } else if (!m_tracked) {
+        m_log("[!] Brak pidfd (Linux < 5.3) - limity równoległych akcji będą uwzględniane tylko dla akcji "
+              "uruchamianych przez proces pomocniczy.");
+    }
+}
+
+ActionDispatcher::~ActionDispatcher() {
+    stopFallback();
+    size_t dropped;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        dropped = m_delayed.size() + m_queue.size();
+        m_delayed.clear();
+        m_delayedStrands.clear();
+        m_queue.clear();
+    }
+    if (m_mode == Wait) {
+        size_t running = m_supervisor.runningCount() + m_spawned.size();
+        if (running > 0) {
+            m_log("[•] Oczekiwanie na zakończenie " + std::to_string(running) + " akcji.");
+        }
+        m_supervisor.detach();
+        waitSpawned();
+    } else {
+        m_supervisor.abandon();
+        m_spawned.clear();
+    }
+    if (m_timerFd >= 0) {
+        close(m_timerFd);
+    }
+    if (m_wakeFd >= 0) {
+        close(m_wakeFd);
+    }
+    if (dropped > 0) {
+        m_log("[•] Porzucono " + std::to_string(dropped) + " oczekujących akcji.");
+    }
+}
+
+void ActionDispatcher::run(const std::shared_ptr<const RuleTable>& rules, const RuleMatch& match,
+                           const CompiledAction& action, const char* devpath) {
+    Launch launch{rules, &action, match.fingerprint, actionSlot(match, action), deviceStrand(devpath ? devpath : ""), 0, false};
+    if (m_timerFd < 0) {
+        // Nothing to hand the launch over to.
+        execute(launch, false);
+        return;
+    }
+
+    if (action.delay_sec > 0) {
+        m_log("[•] Opóźnienie " + std::to_string(action.delay_sec) + "s dla '" + rules->script(action) + "'");
+        uint64_t due = monotonicMs() + uint64_t(action.delay_sec) * 1000;
+        std::lock_guard<std::mutex> lock(m_mutex);
+        launch.order = m_nextOrder++;
+        if (launch.strand) {
+            m_delayedStrands[launch.strand].insert(launch.order);
+        }
+        m_delayed.emplace(m_wheel.schedule(due), std::move(launch));
+        rearm();
+        if (!m_reactor && !m_fallback.joinable()) {
+            startFallback();
+        }
+        return;
+    }
+
+    bool full;
+    bool onLoop = false;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        full = m_queue.size() >= kMaxQueued;
+        if (!full) {
+            launch.order = m_nextOrder++;
+            m_queue.push_back(std::move(launch));
+            onLoop = m_reactor && m_loopThread == std::this_thread::get_id();
+            if (!m_reactor && !m_fallback.joinable()) {
+                startFallback();
+            }
+        }
+    }
+    if (full) {
+        m_log("[!] Kolejka akcji pełna (" + std::to_string(kMaxQueued) + ") - pominięto '" + rules->script(action)
+              + "'.");
+    } else if (onLoop) {
+        pump();
+    } else {
+        wake();
+    }
+}
+
+// Lock held.
+bool ActionDispatcher::delayedBefore(const Launch& launch) const {
+    auto it = m_delayedStrands.find(launch.strand);
+    return it != m_delayedStrands.end() && *it->second.begin() < launch.order;
+}
+
+// Lock held.
+void ActionDispatcher::forgetDelayed(const Launch& launch) {
+    auto it = m_delayedStrands.find(launch.strand);
+    if (it == m_delayedStrands.end()) {
+        return;
+    }
+    it->second.erase(launch.order);
+    if (it->second.empty()) {
+        m_delayedStrands.erase(it);
+    }
+}
+
+bool ActionDispatcher::isStale(const Launch& launch) const {
+    return m_current && launch.rules != m_current && !m_current->containsGroup(launch.fingerprint);
+}
+
+void ActionDispatcher::setCurrentRules(std::shared_ptr<const RuleTable> rules) {
+    size_t dropped = 0;
+    bool queued;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_current = std::move(rules);
+        for (auto it = m_delayed.begin(); it != m_delayed.end();) {
+            if (isStale(it->second)) {
+                m_wheel.cancel(it->first);
+                forgetDelayed(it->second);
+                it = m_delayed.erase(it);
+                ++dropped;
+            } else {
+                ++it;
+            }
+        }
+        if (dropped > 0) {
+            rearm();
+        }
+        size_t before = m_queue.size();
+        m_queue.erase(std::remove_if(m_queue.begin(), m_queue.end(),
+                                     [this](const Launch& launch) { return isStale(launch); }),
+                      m_queue.end());
+        dropped += before - m_queue.size();
+        // Queued actions may have waited on a dropped entry's strand.
+        queued = !m_queue.empty();
+    }
+    if (dropped > 0 && queued) {
+        wake();
+    }
+    if (dropped > 0) {
+        m_log("[•] Anulowano " + std::to_string(dropped) + " oczekujących akcji zmienionych lub usuniętych reguł.");
+    }
+}
+
+void ActionDispatcher::endStrand(std::string_view devpath) {
+    bool released;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        released = m_busyStrands.erase(deviceStrand(devpath)) > 0 && !m_queue.empty();
+    }
+    if (released) {
+        wake();
+    }
+}
+
+void ActionDispatcher::setMaxConcurrent(size_t limit) {
+    bool queued;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_maxConcurrent = limit;
+        queued = !m_queue.empty();
+    }
+    if (queued) {
+        wake();
+    }
+}
+
+size_t ActionDispatcher::pendingCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_delayed.size() + m_queue.size();
+}
+
+size_t ActionDispatcher::runningCount() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_running;
+}
+
+void ActionDispatcher::attach(Reactor& reactor) {
+    if (m_timerFd < 0) {
+        return;
+    }
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_reactor = &reactor;
+    }
+    // Whatever the fallback loop left readable is picked up by this one.
+    stopFallback();
+    reactor.add(m_timerFd, EPOLLIN, [this](uint32_t) { onTimer(); });
+    reactor.add(m_wakeFd, EPOLLIN, [this](uint32_t) { onWake(); });
+    addSpawner(reactor);
+    m_supervisor.attach(reactor);
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_loopThread = std::this_thread::get_id();
+}
+
+void ActionDispatcher::detach(Reactor& reactor) {
+    if (m_timerFd < 0) {
+        return;
+    }
+    size_t running = m_supervisor.runningCount() + m_spawned.size();
+    if (m_mode == Wait && running > 0) {
+        m_log("[•] Oczekiwanie na zakończenie " + std::to_string(running) + " akcji.");
+        m_supervisor.detach();
+        waitSpawned();
+    }
+    reactor.remove(m_timerFd);
+    reactor.remove(m_wakeFd);
+    removeSpawner();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_reactor = nullptr;
+    m_loopThread = std::thread::id();
+    if (!m_delayed.empty() || !m_queue.empty() || m_supervisor.runningCount() > 0 || !m_spawned.empty()) {
+        startFallback();
+    }
+}
+
+// Launches what the limits and strands allow, in queue order. Loop thread.
+void ActionDispatcher::pump() {
+    std::vector<Launch> ready;
+    std::vector<std::string> messages;
+    std::unordered_set<uint64_t> held;     // strands with an earlier entry still queued
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_queue.begin(); it != m_queue.end();) {
+            Launch& launch = *it;
+            if (isStale(launch)) {
+                messages.push_back(std::string("[•] Anulowano akcję '") + launch.rules->script(*launch.action)
+                                   + "' zmienionej lub usuniętej reguły.");
+                it = m_queue.erase(it);
+                continue;
+            }
+            if (launch.strand
+                && (m_busyStrands.count(launch.strand) || held.count(launch.strand) || delayedBefore(launch))) {
+                held.insert(launch.strand);
+                ++it;
+                continue;
+            }
+            uint32_t limit = launch.action->max_concurrent;
+            uint32_t& running = m_runningBySlot[launch.slot];
+            bool globalFull = m_maxConcurrent != 0 && m_running >= m_maxConcurrent;
+            bool actionFull = limit != 0 && running >= limit;
+            if (!globalFull && !actionFull) {
+                ++m_running;
+                ++running;
+                if (launch.strand) {
+                    m_busyStrands[launch.strand] = launch.order;
+                }
+                ready.push_back(std::move(launch));
+                it = m_queue.erase(it);
+                continue;
+            }
+            if (running == 0) {
+                m_runningBySlot.erase(launch.slot);
+            }
+            std::string reason = actionFull ? "limit akcji " + std::to_string(limit)
+                                            : "limit globalny " + std::to_string(m_maxConcurrent);
+            if (launch.action->flags & CompiledAction::DropOverflow) {
+                messages.push_back(std::string("[!] Pominięto akcję '") + launch.rules->script(*launch.action)
+                                   + "' (" + reason + ").");
+                it = m_queue.erase(it);
+                continue;
+            }
+            if (!launch.waiting) {
+                launch.waiting = true;
+                messages.push_back(std::string("[•] Akcja '") + launch.rules->script(*launch.action)
+                                   + "' czeka w kolejce (" + reason + ").");
+            }
+            if (launch.strand) {
+                held.insert(launch.strand);
+            }
+            ++it;
+        }
+    }
+    for (const std::string& message : messages) {
+        m_log(message);
+    }
+    for (const Launch& launch : ready) {
+        if (!execute(launch, m_tracked)) {
+            finished(launch.slot, launch.strand, launch.order);
+        }
+    }
+}
+
+void ActionDispatcher::finished(uint64_t slot, uint64_t strand, uint64_t order) {
+    bool queued;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        --m_running;
+        // endStrand() may have handed the strand to a later script already.
+        auto busy = m_busyStrands.find(strand);
+        if (busy != m_busyStrands.end() && busy->second == order) {
+            m_busyStrands.erase(busy);
+        }
+        auto it = m_runningBySlot.find(slot);
+        if (it != m_runningBySlot.end() && --it->second == 0) {
+            m_runningBySlot.erase(it);
+        }
+        queued = !m_queue.empty();
+    }
+    // Not pumped from here: this may be a reap outside the loop.
+    if (queued) {
+        wake();
+    }
+}
+
+void ActionDispatcher::wake() {
+    uint64_t one = 1;
+    while (write(m_wakeFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+void ActionDispatcher::onWake() {
+    uint64_t value;
+    if (read(m_wakeFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        return;
+    }
+    pump();
+}
+
+// Armed only when the earliest wakeup changes. Lock held.
+void ActionDispatcher::rearm() {
+    uint64_t when = 0;
+    if (!m_wheel.nextWakeup(when)) {
+        when = 0;
+    }
+    if (when == m_armed) {
+        return;
+    }
+    struct itimerspec spec = {};
+    spec.it_value.tv_sec = time_t(when / 1000);
+    spec.it_value.tv_nsec = long(when % 1000) * 1000000;
+    if (timerfd_settime(m_timerFd, TFD_TIMER_ABSTIME, &spec, nullptr) == 0) {
+        m_armed = when;
+    }
+}
+
+void ActionDispatcher::onTimer() {
+    uint64_t expirations;
+    if (read(m_timerFd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        return;
+    }
+    std::vector<TimerWheel::Id> expired;
+    std::vector<std::string> messages;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_armed = 0;
+        m_wheel.advance(monotonicMs(), expired);
+        for (TimerWheel::Id id : expired) {
+            auto it = m_delayed.find(id);
+            if (it == m_delayed.end()) {
+                continue;
+            }
+            Launch& launch = it->second;
+            forgetDelayed(launch);
+            // Queued from a table that was replaced after the last prune.
+            if (isStale(launch)) {
+                messages.push_back(std::string("[•] Anulowano opóźnioną akcję '") + launch.rules->script(*launch.action)
+                                   + "' zmienionej lub usuniętej reguły.");
+            } else if (m_queue.size() >= kMaxQueued) {
+                messages.push_back("[!] Kolejka akcji pełna (" + std::to_string(kMaxQueued) + ") - pominięto '"
+                                   + launch.rules->script(*launch.action) + "'.");
+            } else {
+                // Back to its place in run() order, ahead of its strand's
+                // later actions that waited for it.
+                auto pos = m_queue.end();
+                while (pos != m_queue.begin() && std::prev(pos)->order > launch.order) {
+                    --pos;
+                }
+                m_queue.insert(pos, std::move(launch));
+            }
+            m_delayed.erase(it);
+        }
+        rearm();
+    }
+    for (const std::string& message : messages) {
+        m_log(message);
+    }
+    pump();
+}
+
+// Lock held, no loop running.
+void ActionDispatcher::startFallback() {
+    m_ownLoop.add(m_timerFd, EPOLLIN, [this](uint32_t) { onTimer(); });
+    m_ownLoop.add(m_wakeFd, EPOLLIN, [this](uint32_t) { onWake(); });
+    addSpawner(m_ownLoop);
+    m_supervisor.attach(m_ownLoop);
+    m_fallback = std::thread([this] { m_ownLoop.run(); });
+}
+
+void ActionDispatcher::stopFallback() {
+    std::thread fallback;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        fallback = std::move(m_fallback);
+    }
+    if (!fallback.joinable()) {
+        return;
+    }
+    m_ownLoop.stop();
+    fallback.join();
+    m_ownLoop.reset();
+    m_ownLoop.remove(m_timerFd);
+    m_ownLoop.remove(m_wakeFd);
+    removeSpawner();
+}
+
+void ActionDispatcher::setSpawner(Spawner* spawner) {
+    m_spawner = spawner;
+    if (m_spawner && m_timerFd < 0) {
+        m_log("[!] Bez pętli akcji proces uruchamiający nie będzie używany - akcje startują przez fork().");
+    }
+}
+
+void ActionDispatcher::addSpawner(Reactor& reactor) {
+    if (m_spawner && reactor.add(m_spawner->fd(), EPOLLIN, [this](uint32_t) { onSpawner(); })) {
+        m_spawnerLoop = &reactor;
+    }
+}
+
+void ActionDispatcher::removeSpawner() {
+    if (m_spawnerLoop) {
+        m_spawnerLoop->remove(m_spawner->fd());
+        m_spawnerLoop = nullptr;
+    }
+}
+
+bool ActionDispatcher::spawnRemote(const Launch& launch, const char* script, const char* const* argv) {
+    uint64_t tag = ++m_spawnTag;
+    if (!m_spawner->spawn(tag, argv, m_mode == Detached ? uint32_t(Spawner::NewSession) : 0u)) {
+        // Too many arguments for one request, or the helper is gone.
+        if (!m_spawner->isAlive()) {
+            spawnerLost();
+        }
+        return false;
+    }
+    m_spawned.emplace(tag, Spawned{script, launch.slot, launch.strand, launch.order, std::chrono::steady_clock::now()});
+    return true;
+}
+
+void ActionDispatcher::onSpawner() {
+    Spawner::Event event;
+    while (m_spawner && m_spawner->receive(event, false)) {
+        onSpawned(event);
+    }
+    if (m_spawner && !m_spawner->isAlive()) {
+        spawnerLost();
+    }
+}
+
+void ActionDispatcher::onSpawned(const Spawner::Event& event) {
+    auto it = m_spawned.find(event.tag);
+    if (it == m_spawned.end()) {
+        return;
+    }
+    const Spawned& spawned = it->second;
+    switch (event.type) {
+    case Spawner::Event::Started:
+        if (m_mode == Detached) {
+            m_log("[✓] Akcja '" + spawned.script + "' uruchomiona.");
+        }
+        return;
+    case Spawner::Event::Failed:
+        m_log("[!] Nie można uruchomić '" + spawned.script + "': " + strerror(event.value));
+        break;
+    case Spawner::Event::Exited:
+        if (m_mode == Wait) {
+            logExit(spawned.script, event.value,
+                    std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()
+                                                                          - spawned.started));
+        } else if (WIFEXITED(event.value) && WEXITSTATUS(event.value) == 127) {
+            m_log("[!] Nie można uruchomić '" + spawned.script + "'.");
+        }
+        break;
+    }
+    uint64_t slot = spawned.slot;
+    uint64_t strand = spawned.strand;
+    uint64_t order = spawned.order;
+    m_spawned.erase(it);
+    finished(slot, strand, order);
+}
+
+// Scripts it started are no longer tracked; their slots are released.
+void ActionDispatcher::spawnerLost() {
+    m_log("[!] Proces uruchamiający akcje zakończył się - akcje będą uruchamiane bezpośrednio.");
+    removeSpawner();
+    m_spawner = nullptr;
+    for (const auto& entry : m_spawned) {
+        finished(entry.second.slot, entry.second.strand, entry.second.order);
+    }
+    m_spawned.clear();
+}
+
+void ActionDispatcher::waitSpawned() {
+    Spawner::Event event;
+    while (!m_spawned.empty() && m_spawner) {
+        if (m_spawner->receive(event, true)) {
+            onSpawned(event);
+        } else if (!m_spawner->isAlive()) {
+            spawnerLost();
+        }
+    }
+}
+
+// True if the script runs under the supervisor or the helper and finished()
+// is still to come for it.
+bool ActionDispatcher::execute(const Launch& launch, bool track) {
+    const RuleTable& rules = *launch.rules;
+    const CompiledAction& action = *launch.action;
+    const char* script = rules.script(action);
+    // Bare names are looked up in PATH by execvp.
+    if (strchr(script, '/') && access(script, X_OK) != 0) {
+        m_log("[X] Skrypt '" + std::string(script) + "' nie jest wykonywalny.");
+        return false;
+    }
+
+    // argv is built before fork; small argument lists stay on the stack.
+    const char* inlineArgv[kInlineArgs];
+    std::vector<const char*> heapArgv;
+    const char** argv = inlineArgv;
+    if (size_t(action.args_count) + 2 > kInlineArgs) {
+        heapArgv.resize(size_t(action.args_count) + 2);
+        argv = heapArgv.data();
+    }
+    argv[0] = script;
+    for (size_t i = 0; i < action.args_count; ++i) {
+        argv[i + 1] = rules.arg(action, i);
+    }
+    argv[action.args_count + 1] = nullptr;
+
+    // The helper reports exits itself, so it is used with or without pidfd.
+    if (m_spawnerLoop && spawnRemote(launch, script, argv)) {
+        return true;
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        m_log("[!] fork() nie powiódł się: " + std::string(strerror(errno)));
+        return false;
+    }
+
+    if (m_mode == Detached && !track) {
+        // Double fork: the intermediate child exits at once, so no zombie is
+        // left behind and the script outlives us.
+        if (pid == 0) {
+            setsid();
+            pid_t grandchild = fork();
+            if (grandchild == 0) {
+                execAction(argv, false);
+            }
+            _exit(grandchild < 0 ? 1 : 0);
+        }
+        int status = waitChild(pid);
+        if (status < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+            m_log("[!] Nie można uruchomić '" + std::string(script) + "'.");
+            return false;
+        }
+        m_log("[✓] Akcja '" + std::string(script) + "' uruchomiona.");
+        return false;
+    }
+
+    if (pid == 0) {
+        execAction(argv, m_mode == Detached);
+    }
+    std::string name(script);
+    uint64_t slot = launch.slot;
+    uint64_t strand = launch.strand;
+    uint64_t order = launch.order;
+    if (track && m_supervisor.watch(pid, [this, name, slot, strand, order](int status,
+                                                                           std::chrono::milliseconds duration) {
+            if (m_mode == Wait) {
+                logExit(name, status, duration);
+            } else if (status >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 127) {
+                m_log("[!] Nie można uruchomić '" + name + "'.");
+            }
+            finished(slot, strand, order);
+        })) {
+        if (m_mode == Detached) {
+            m_log("[✓] Akcja '" + name + "' uruchomiona.");
+        }
+        return true;
+    }
+    if (m_mode == Detached) {
+        // Still our child: reaped aside so it leaves no zombie.
+        std::thread([pid] { waitChild(pid); }).detach();
+        m_log("[✓] Akcja '" + name + "' uruchomiona.");
+        return false;
+    }
+    auto started = std::chrono::steady_clock::now();
+    int status = waitChild(pid);
+    logExit(name, status,
+            std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - started));
+    return false;
+}
+
+void ActionDispatcher::logExit(const std::string& script, int status, std::chrono::milliseconds duration) {
+    std::string took = " (" + std::to_string(duration.count()) + " ms)";
+    if (status >= 0 && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        m_log("[✓] Akcja '" + script + "' zakończona sukcesem" + took + ".");
+    } else if (status >= 0 && WIFSIGNALED(status)) {
+        m_log("[X] Akcja '" + script + "' przerwana sygnałem " + std::to_string(WTERMSIG(status)) + took + ".");
+    } else {
+        m_log("[X] Akcja '" + script + "' błąd. Kod: " + std::to_string(status >= 0 ? WEXITSTATUS(status) : -1)
+              + took);
+    }
+}
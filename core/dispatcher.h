@@ -0,0 +1,165 @@
+#ifndef DISPATCHER_H
+#define DISPATCHER_H
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include "logsink.h"
+#include "reactor.h"
+#include "ruletable.h"
+#include "spawner.h"
+#include "supervisor.h"
+#include "timerwheel.h"
+
+// Starts rule actions: fork/exec of the script with stdout/stderr on
+// /dev/null. Strings come straight from the rule table. Scripts are reaped
+// through their pidfds by a ProcessSupervisor on the event loop, or by the
+// Spawner helper when one is set; in Wait mode their exit code and run
+// time are logged.
+//
+// All launches happen on one loop: the engine's while attached, otherwise
+// a fallback thread with a private reactor. Actions run from other threads
+// (a scan) are handed over through a queue and an eventfd. At most
+// maxConcurrent scripts run at once, and at most max_concurrent of any one
+// action; runs over a limit wait in FIFO order, without holding up other
+// rules' runs, or are dropped when the action says so.
+//
+// Actions for one device form a strand: each starts only after the one
+// before it, in the order run() got them, has finished, so a rule's
+// "init" script completes before its "flash" script starts. A delayed
+// action keeps its place: later actions of the device wait out its delay. Strands of
+// different devices run side by side, and the scripts themselves, being
+// processes, spread over all cores. A strand ends with its device: once it
+// is removed, actions of whatever is plugged into the same port next don't
+// wait for a script that is still running or hung.
+//
+// Delayed actions wait in a TimerWheel behind one timerfd, each holding the
+// table it was matched in, so thousands of pending delays cost no thread
+// and timers due in the same millisecond fire in one wakeup. A reload
+// doesn't disturb waiting actions as long as their rule is still there
+// unchanged; actions of changed or removed rules are dropped.
+class ActionDispatcher {
+public:
+    enum Mode {
+        Detached,   // fire and forget, the script gets its own session (GUI)
+        Wait        // log the script's exit code, wait for it on shutdown (CLI daemon)
+    };
+
+    static const size_t kDefaultMaxConcurrent = 64;
+    static const size_t kMaxQueued = 1024;
+
+    ActionDispatcher(Mode mode, LogSink log);
+    // Pending delayed and queued actions are dropped. In Wait mode scripts
+    // still running are waited for; Detached ones are left running.
+    ~ActionDispatcher();
+
+    ActionDispatcher(const ActionDispatcher&) = delete;
+    ActionDispatcher& operator=(const ActionDispatcher&) = delete;
+
+    // Runs the action now, or queues it until its delay has passed, a limit
+    // lets it start and the device's previous action has finished. A null
+    // devpath puts the action on no strand. Any thread.
+    void run(const std::shared_ptr<const RuleTable>& rules, const RuleMatch& match, const CompiledAction& action,
+             const char* devpath);
+
+    // The device at devpath is gone: its running script no longer holds
+    // the actions queued behind it. Any thread.
+    void endStrand(std::string_view devpath);
+
+    // Tells the dispatcher which table is live after a reload.
+    void setCurrentRules(std::shared_ptr<const RuleTable> rules);
+
+    // Scripts running at once over all rules, 0 for no limit. Any thread.
+    void setMaxConcurrent(size_t limit);
+
+    // Starts scripts through a pre-forked helper instead of forking this
+    // process; null goes back to fork(). Not owned. Before the first action.
+    void setSpawner(Spawner* spawner);
+
+    // Actions are launched, and scripts reaped, from reactor's loop until
+    // detach(), which in Wait mode waits for scripts still running. Called
+    // on the loop's thread.
+    void attach(Reactor& reactor);
+    void detach(Reactor& reactor);
+
+    // Delayed and queued actions.
+    size_t pendingCount();
+    size_t runningCount();
+
+private:
+    struct Launch {
+        std::shared_ptr<const RuleTable> rules;
+        const CompiledAction* action;
+        uint64_t fingerprint;
+        uint64_t slot;      // the action within its group, for max_concurrent
+        uint64_t strand;    // hash of the devpath, 0 for none
+        uint64_t order;     // run() order; the queue is sorted by it
+        bool waiting;       // already logged as queued
+    };
+
+    struct Spawned {
+        std::string script;
+        uint64_t slot;
+        uint64_t strand;
+        uint64_t order;
+        std::chrono::steady_clock::time_point started;
+    };
+
+    bool execute(const Launch& launch, bool track);
+    bool spawnRemote(const Launch& launch, const char* script, const char* const* argv);
+    void logExit(const std::string& script, int status, std::chrono::milliseconds duration);
+    bool isStale(const Launch& launch) const;
+    bool delayedBefore(const Launch& launch) const;
+    void forgetDelayed(const Launch& launch);
+    void pump();
+    void finished(uint64_t slot, uint64_t strand, uint64_t order);
+    void wake();
+    void onWake();
+    void rearm();
+    void onTimer();
+    void startFallback();
+    void stopFallback();
+    void addSpawner(Reactor& reactor);
+    void removeSpawner();
+    void onSpawner();
+    void onSpawned(const Spawner::Event& event);
+    void spawnerLost();
+    void waitSpawned();
+
+    Mode m_mode;
+    LogSink m_log;
+    int m_timerFd;
+    int m_wakeFd;                   // work queued for the loop
+    bool m_tracked;                 // pidfds available, children are counted
+
+    std::mutex m_mutex;
+    TimerWheel m_wheel;
+    std::unordered_map<TimerWheel::Id, Launch> m_delayed;
+    std::deque<Launch> m_queue;
+    size_t m_maxConcurrent = kDefaultMaxConcurrent;
+    size_t m_running = 0;
+    std::unordered_map<uint64_t, uint32_t> m_runningBySlot;
+    std::unordered_map<uint64_t, uint64_t> m_busyStrands;  // to the running script's order
+    // run() order of each strand's delayed actions; later ones wait for them.
+    std::unordered_map<uint64_t, std::set<uint64_t>> m_delayedStrands;
+    uint64_t m_nextOrder = 0;
+    uint64_t m_armed = 0;           // timerfd deadline, 0 when disarmed
+    std::shared_ptr<const RuleTable> m_current;
+    Reactor* m_reactor = nullptr;
+    std::thread::id m_loopThread;   // the attached reactor's
+    Reactor m_ownLoop;
+    std::thread m_fallback;
+    ProcessSupervisor m_supervisor;     // loop thread only
+    Spawner* m_spawner = nullptr;       // loop thread only, from here down
+    Reactor* m_spawnerLoop = nullptr;
+    uint64_t m_spawnTag = 0;
+    std::unordered_map<uint64_t, Spawned> m_spawned;    // by tag
+};
+
+#endif // DISPATCHER_H
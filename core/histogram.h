@@ -0,0 +1,80 @@
+#ifndef HISTOGRAM_H
+#define HISTOGRAM_H
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+// Counts of event batch sizes in power-of-two buckets below the batch cap:
+// 1, 2-3, 4-7, ..., and one bucket for batches that hit the cap, the sign
+// that the socket had more queued than one wakeup takes. Written by the
+// event thread, readable from any thread.
+class BatchHistogram {
+public:
+    static const size_t kMaxBuckets = 17;
+
+    // cap: the most one batch takes, at most 65536.
+    explicit BatchHistogram(size_t cap) : m_cap(cap), m_capBucket(0) {
+        while (m_capBucket + 1 < kMaxBuckets && ((cap - 1) >> m_capBucket) != 0) {
+            ++m_capBucket;
+        }
+        for (auto& count : m_counts) {
+            count.store(0, std::memory_order_relaxed);
+        }
+    }
+
+    void record(size_t size) {
+        if (size == 0) {
+            return;
+        }
+        size_t bucket = m_capBucket;
+        if (size < m_cap) {
+            bucket = 0;
+            while ((size >> (bucket + 1)) != 0) {
+                ++bucket;
+            }
+        }
+        m_counts[bucket].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t bucketCount() const { return m_capBucket + 1; }
+    uint64_t count(size_t bucket) const { return m_counts[bucket].load(std::memory_order_relaxed); }
+    // Batches that stopped at the cap.
+    uint64_t capped() const { return count(m_capBucket); }
+
+    // "1:120 2-3:4 8-15:1 256+ (limit):2", empty buckets left out.
+    std::string format() const {
+        std::string out;
+        for (size_t bucket = 0; bucket <= m_capBucket; ++bucket) {
+            uint64_t n = count(bucket);
+            if (n == 0) {
+                continue;
+            }
+            if (!out.empty()) {
+                out += ' ';
+            }
+            if (bucket == m_capBucket) {
+                out += std::to_string(m_cap) + "+ (limit)";
+            } else {
+                size_t lo = size_t(1) << bucket;
+                size_t hi = std::min((lo << 1) - 1, m_cap - 1);
+                out += std::to_string(lo);
+                if (hi != lo) {
+                    out += '-' + std::to_string(hi);
+                }
+            }
+            out += ':' + std::to_string(n);
+        }
+        return out.empty() ? "brak" : out;
+    }
+
+private:
+    size_t m_cap;
+    size_t m_capBucket;
+    std::array<std::atomic<uint64_t>, kMaxBuckets> m_counts;
+};
+
+#endif // HISTOGRAM_H
@@ -0,0 +1,11 @@
+#ifndef LOGSINK_H
+#define LOGSINK_H
+
+#include <functional>
+#include <string>
+
+// Where core components send their log lines: the GUI log view, or stdout and
+// /var/log/autotriggers.log in the CLI. May be called from any thread.
+using LogSink = std::function<void(const std::string&)>;
+
+#endif // LOGSINK_H
@@ -0,0 +1,63 @@
+#ifndef NAMECACHE_H
+#define NAMECACHE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+// Display names ("manufacturer product") by VID:PID, least recently used
+// dropped first. Only for logs: devices sharing a VID:PID show the name
+// first resolved for it. Any thread.
+class NameCache {
+public:
+    static const size_t kDefaultCapacity = 256;
+
+    explicit NameCache(size_t capacity = kDefaultCapacity) : m_capacity(capacity) {}
+
+    bool find(uint32_t key, std::string& out) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it == m_index.end()) {
+            return false;
+        }
+        m_entries.splice(m_entries.begin(), m_entries, it->second);
+        out = it->second->second;
+        return true;
+    }
+
+    void insert(uint32_t key, const std::string& name) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto it = m_index.find(key);
+        if (it != m_index.end()) {
+            it->second->second = name;
+            m_entries.splice(m_entries.begin(), m_entries, it->second);
+            return;
+        }
+        m_entries.emplace_front(key, name);
+        m_index.emplace(key, m_entries.begin());
+        if (m_entries.size() > m_capacity) {
+            m_index.erase(m_entries.back().first);
+            m_entries.pop_back();
+        }
+    }
+
+    void clear() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_entries.clear();
+        m_index.clear();
+    }
+
+private:
+    using Entry = std::pair<uint32_t, std::string>;
+
+    std::mutex m_mutex;
+    size_t m_capacity;
+    std::list<Entry> m_entries;     // most recently used first
+    std::unordered_map<uint32_t, std::list<Entry>::iterator> m_index;
+};
+
+#endif // NAMECACHE_H
@@ -0,0 +1,90 @@
+#ifndef PORTPATH_H
+#define PORTPATH_H
+
+#include <cstring>
+#include <string>
+
+// Physical port of a device: the USB part of its sysfs devpath, starting at
+// the root hub ("usb1/1-3/1-3.2"). It stays the same whatever gets plugged in.
+
+inline bool isPortPathDigit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// Returns the "usbN/..." part of a devpath ("/devices/pci0000:00/.../usb1/1-3"),
+// or nullptr if there is none.
+inline const char* findPortPath(const char* devpath) {
+    if (!devpath) {
+        return nullptr;
+    }
+    for (const char* comp = devpath; *comp; ) {
+        if (strncmp(comp, "usb", 3) == 0 && isPortPathDigit(comp[3])) {
+            const char* p = comp + 3;
+            while (isPortPathDigit(*p)) {
+                ++p;
+            }
+            if (*p == '\0' || *p == '/') {
+                return comp;
+            }
+        }
+        const char* slash = strchr(comp, '/');
+        if (!slash) {
+            break;
+        }
+        comp = slash + 1;
+    }
+    return nullptr;
+}
+
+// Parses a "port:" rule key (without the prefix) into a canonical path.
+// Accepted forms: "usb1/1-3/1-3.2", a full sysfs devpath, or a path starting
+// at the port ("1-3/1-3.2", the bus is taken from the port name). A trailing
+// "*" matches the port and everything behind it (hubs).
+inline bool parsePortPattern(const std::string& text, std::string& path, bool& prefix) {
+    std::string s = text;
+    prefix = false;
+    if (!s.empty() && s.back() == '*') {
+        prefix = true;
+        s.pop_back();
+        while (!s.empty() && (s.back() == '/' || s.back() == '.')) {
+            s.pop_back();
+        }
+    }
+    if (s.empty() || s.find('*') != std::string::npos) {
+        return false;
+    }
+
+    if (const char* start = findPortPath(s.c_str())) {
+        s.erase(0, size_t(start - s.c_str()));
+    } else {
+        size_t dash = s.find('-');
+        if (dash == 0 || dash == std::string::npos) {
+            return false;
+        }
+        for (size_t i = 0; i < dash; ++i) {
+            if (!isPortPathDigit(s[i])) {
+                return false;
+            }
+        }
+        s = "usb" + s.substr(0, dash) + "/" + s;
+    }
+    while (!s.empty() && s.back() == '/') {
+        s.pop_back();
+    }
+    if (s.find("//") != std::string::npos) {
+        return false;
+    }
+    path = s;
+    return true;
+}
+
+// Compares the component [comp, comp + len) with a NUL-terminated string.
+inline int comparePortComponent(const char* str, const char* comp, size_t len) {
+    int c = strncmp(str, comp, len);
+    if (c != 0) {
+        return c;
+    }
+    return str[len] == '\0' ? 0 : 1;
+}
+
+#endif // PORTPATH_H
@@ -0,0 +1,149 @@
+#ifndef RCUCELL_H
+#define RCUCELL_H
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+// Holds the live snapshot of an immutable object for readers that must never
+// block (the uevent thread). Readers get the snapshot with one acquire load
+// and no lock; the writer swaps in a new one and retires the old.
+//
+// Reclamation is quiescent-state based: every reader owns an epoch slot and
+// reports, between read-side sections, that it holds no snapshot pointer any
+// more (quiescent(), or offline() around blocking calls). A retired snapshot
+// is released once every online reader has passed the epoch it was retired
+// in. Whoever copied the shared_ptr out of a read keeps that snapshot alive
+// on its own, so dispatches in flight are unaffected.
+template <typename T>
+class RcuCell {
+public:
+    using Pointer = std::shared_ptr<const T>;
+
+    // One per reading thread.
+    class Reader {
+    public:
+        explicit Reader(RcuCell& cell) : m_cell(cell), m_slot(cell.addReader()) {
+            online();
+        }
+        ~Reader() {
+            m_cell.removeReader(m_slot);
+        }
+
+        Reader(const Reader&) = delete;
+        Reader& operator=(const Reader&) = delete;
+
+        // Valid until the next quiescent() or offline().
+        const Pointer& read() const {
+            return m_cell.m_current.load(std::memory_order_acquire)->value;
+        }
+
+        void quiescent() {
+            m_slot->store(m_cell.m_epoch.load(std::memory_order_seq_cst), std::memory_order_seq_cst);
+        }
+        void offline() {
+            m_slot->store(kOffline, std::memory_order_seq_cst);
+        }
+        void online() {
+            quiescent();
+        }
+
+    private:
+        RcuCell& m_cell;
+        std::atomic<uint64_t>* m_slot;
+    };
+
+    explicit RcuCell(Pointer initial) : m_current(new Node{std::move(initial)}), m_epoch(1) {
+    }
+
+    // Readers must be gone by now.
+    ~RcuCell() {
+        for (const Retired& retired : m_retired) {
+            delete retired.node;
+        }
+        delete m_current.load();
+    }
+
+    RcuCell(const RcuCell&) = delete;
+    RcuCell& operator=(const RcuCell&) = delete;
+
+    // For threads that aren't registered readers. Takes the writer lock.
+    Pointer load() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return m_current.load()->value;
+    }
+
+    void publish(Pointer value) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        Node* old = m_current.exchange(new Node{std::move(value)}, std::memory_order_seq_cst);
+        uint64_t epoch = m_epoch.fetch_add(1, std::memory_order_seq_cst) + 1;
+        m_retired.push_back(Retired{old, epoch});
+        reclaimLocked();
+    }
+
+    // Releases what no reader can still see. Returns the number of retired
+    // snapshots left, so the writer knows whether to try again later.
+    size_t reclaim() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        return reclaimLocked();
+    }
+
+private:
+    static const uint64_t kOffline = 0;
+
+    struct Node {
+        Pointer value;
+    };
+
+    struct Retired {
+        Node* node;
+        uint64_t epoch;
+    };
+
+    std::atomic<uint64_t>* addReader() {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_readers.emplace_back(new std::atomic<uint64_t>(kOffline));
+        return m_readers.back().get();
+    }
+
+    void removeReader(std::atomic<uint64_t>* slot) {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto it = m_readers.begin(); it != m_readers.end(); ++it) {
+            if (it->get() == slot) {
+                m_readers.erase(it);
+                break;
+            }
+        }
+        reclaimLocked();
+    }
+
+    size_t reclaimLocked() {
+        uint64_t oldest = UINT64_MAX;
+        for (const auto& slot : m_readers) {
+            uint64_t epoch = slot->load(std::memory_order_seq_cst);
+            if (epoch != kOffline && epoch < oldest) {
+                oldest = epoch;
+            }
+        }
+        size_t kept = 0;
+        for (const Retired& retired : m_retired) {
+            if (retired.epoch <= oldest) {
+                delete retired.node;
+            } else {
+                m_retired[kept++] = retired;
+            }
+        }
+        m_retired.resize(kept);
+        return kept;
+    }
+
+    std::atomic<Node*> m_current;
+    std::atomic<uint64_t> m_epoch;
+    std::mutex m_mutex;     // writers, reader registration
+    std::vector<std::unique_ptr<std::atomic<uint64_t>>> m_readers;
+    std::vector<Retired> m_retired;
+};
+
+#endif // RCUCELL_H
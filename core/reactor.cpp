@@ -0,0 +1,93 @@
+#include "reactor.h"
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+namespace {
+
+const int kMaxEvents = 32;
+
+} // namespace
+
+Reactor::Reactor()
+    : m_epoll(epoll_create1(EPOLL_CLOEXEC)),
+      m_stopFd(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)),
+      m_stopRequested(false) {
+    if (m_epoll >= 0 && m_stopFd >= 0) {
+        struct epoll_event ev = {};
+        ev.events = EPOLLIN;
+        ev.data.fd = m_stopFd;
+        epoll_ctl(m_epoll, EPOLL_CTL_ADD, m_stopFd, &ev);
+    }
+}
+
+Reactor::~Reactor() {
+    if (m_stopFd >= 0) {
+        close(m_stopFd);
+    }
+    if (m_epoll >= 0) {
+        close(m_epoll);
+    }
+}
+
+bool Reactor::add(int fd, uint32_t events, Handler handler) {
+    if (m_epoll < 0 || fd < 0) {
+        return false;
+    }
+    struct epoll_event ev = {};
+    ev.events = events;
+    ev.data.fd = fd;
+    if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, fd, &ev) != 0) {
+        return false;
+    }
+    m_handlers[fd] = std::make_shared<Handler>(std::move(handler));
+    return true;
+}
+
+void Reactor::remove(int fd) {
+    if (m_handlers.erase(fd) > 0) {
+        epoll_ctl(m_epoll, EPOLL_CTL_DEL, fd, nullptr);
+    }
+}
+
+bool Reactor::run() {
+    struct epoll_event events[kMaxEvents];
+    while (!m_stopRequested.load(std::memory_order_acquire)) {
+        int count = epoll_wait(m_epoll, events, kMaxEvents, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        for (int i = 0; i < count && !m_stopRequested.load(std::memory_order_acquire); ++i) {
+            int fd = events[i].data.fd;
+            if (fd == m_stopFd) {
+                uint64_t value;
+                while (read(m_stopFd, &value, sizeof(value)) > 0) {
+                }
+                continue;
+            }
+            // A handler earlier in this batch may have removed the source.
+            auto it = m_handlers.find(fd);
+            if (it == m_handlers.end()) {
+                continue;
+            }
+            std::shared_ptr<Handler> handler = it->second;
+            (*handler)(events[i].events);
+        }
+    }
+    return true;
+}
+
+void Reactor::stop() {
+    m_stopRequested.store(true, std::memory_order_release);
+    uint64_t one = 1;
+    while (write(m_stopFd, &one, sizeof(one)) < 0 && errno == EINTR) {
+    }
+}
+
+void Reactor::reset() {
+    m_stopRequested.store(false, std::memory_order_release);
+}
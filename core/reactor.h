@@ -0,0 +1,46 @@
+#ifndef REACTOR_H
+#define REACTOR_H
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <unordered_map>
+
+// epoll loop the engine's event sources plug into (udev monitor, inotify,
+// timers, child processes, control sockets). Idle means blocked in
+// epoll_wait without a timeout; stop() goes through an eventfd, so it works
+// from any thread and takes effect at once.
+class Reactor {
+public:
+    using Handler = std::function<void(uint32_t events)>;
+
+    Reactor();
+    ~Reactor();
+
+    Reactor(const Reactor&) = delete;
+    Reactor& operator=(const Reactor&) = delete;
+
+    bool isValid() const { return m_epoll >= 0 && m_stopFd >= 0; }
+
+    // The fd stays owned by the caller. Handlers run on the thread in run()
+    // and may add or remove sources, themselves included.
+    bool add(int fd, uint32_t events, Handler handler);
+    void remove(int fd);
+
+    // Dispatches until stop(). Returns false if epoll_wait fails.
+    bool run();
+
+    // Any thread. A stop before run() makes that run() return at once.
+    void stop();
+    // Clears a stop that run() hasn't consumed.
+    void reset();
+
+private:
+    int m_epoll;
+    int m_stopFd;
+    std::atomic<bool> m_stopRequested;
+    std::unordered_map<int, std::shared_ptr<Handler>> m_handlers;
+};
+
+#endif // REACTOR_H
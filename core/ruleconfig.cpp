@@ -0,0 +1,117 @@
+#include "ruleconfig.h"
+#include "rulestream.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iomanip>
+#include <nlohmann/json.hpp>
+#include <unordered_map>
+
+using json = nlohmann::ordered_json;
+
+namespace {
+
+bool fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+} // namespace
+
+bool RuleConfig::load(const std::string& path, std::string* error) {
+    // A repeated key replaces the earlier one, as with the JSON object semantics.
+    std::vector<RuleEntry> entries;
+    std::unordered_map<std::string, size_t> index;
+    bool ok = RuleStreamReader::readFile(path, [&](const std::string& key, const std::vector<ActionSpec>& actions) {
+        auto it = index.emplace(key, entries.size());
+        if (it.second) {
+            entries.push_back(RuleEntry{key, actions});
+        } else {
+            entries[it.first->second].actions = actions;
+        }
+    }, error);
+    if (!ok) {
+        return false;
+    }
+    m_entries = std::move(entries);
+    return true;
+}
+
+bool RuleConfig::save(const std::string& path, std::string* error) const {
+    json j = json::object();
+    for (const RuleEntry& entry : m_entries) {
+        json actions = json::array();
+        for (const ActionSpec& spec : entry.actions) {
+            json action;
+            action["action_script"] = spec.script;
+            action["action_args"] = spec.args;
+            action["auth_required"] = spec.auth_required;
+            action["delay_sec"] = spec.delay_sec;
+            if (spec.max_concurrent > 0) {
+                action["max_concurrent"] = spec.max_concurrent;
+            }
+            if (spec.drop_overflow) {
+                action["overflow"] = "drop";
+            }
+            if (!spec.match.empty()) {
+                json match = json::object();
+                for (const auto& [attr, value] : spec.match) {
+                    match[attr] = value;
+                }
+                action["match"] = match;
+            }
+            actions.push_back(action);
+        }
+        j[entry.key] = actions;
+    }
+
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream file(tmpPath, std::ios::trunc);
+        if (!file.is_open()) {
+            return fail(error, "nie mozna utworzyc '" + tmpPath + "'");
+        }
+        file << std::setw(4) << j << std::endl;
+        if (!file.good()) {
+            file.close();
+            std::remove(tmpPath.c_str());
+            return fail(error, "blad zapisu '" + tmpPath + "'");
+        }
+    }
+    if (std::rename(tmpPath.c_str(), path.c_str()) != 0) {
+        int err = errno;
+        std::remove(tmpPath.c_str());
+        return fail(error, "nie mozna zapisac '" + path + "': " + strerror(err));
+    }
+    return true;
+}
+
+size_t RuleConfig::actionCount() const {
+    size_t count = 0;
+    for (const RuleEntry& entry : m_entries) {
+        count += entry.actions.size();
+    }
+    return count;
+}
+
+void RuleConfig::add(const std::string& key, const ActionSpec& action) {
+    auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                           [&key](const RuleEntry& entry) { return entry.key == key; });
+    if (it == m_entries.end()) {
+        m_entries.push_back(RuleEntry{key, {}});
+        it = m_entries.end() - 1;
+    }
+    it->actions.push_back(action);
+}
+
+bool RuleConfig::remove(const std::string& key) {
+    auto it = std::find_if(m_entries.begin(), m_entries.end(),
+                           [&key](const RuleEntry& entry) { return entry.key == key; });
+    if (it == m_entries.end()) {
+        return false;
+    }
+    m_entries.erase(it);
+    return true;
+}
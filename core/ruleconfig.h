@@ -0,0 +1,50 @@
+#ifndef RULECONFIG_H
+#define RULECONFIG_H
+
+#include <string>
+#include <utility>
+#include <vector>
+
+// Single action bound to a key pattern, as stored in triggers.json.
+struct ActionSpec {
+    std::string script;
+    std::vector<std::string> args;
+    bool auth_required = false;
+    int delay_sec = 0;
+    // At most this many runs of the action at once, 0 for no limit. Runs
+    // over it (or over the global limit) wait in a queue, or are dropped
+    // with "overflow": "drop".
+    int max_concurrent = 0;
+    bool drop_overflow = false;
+    // Optional "match" object: attribute name -> required value, all must hold.
+    std::vector<std::pair<std::string, std::string>> match;
+};
+
+struct RuleEntry {
+    std::string key;
+    std::vector<ActionSpec> actions;
+};
+
+// Editable form of triggers.json, keys kept in file order. This is what the
+// GUI table and the CLI menu work on; the daemon path compiles it into a
+// RuleTable.
+class RuleConfig {
+public:
+    bool load(const std::string& path, std::string* error = nullptr);
+
+    // Writes to a temporary file and renames it over path, so a running
+    // monitor never reloads a half-written file.
+    bool save(const std::string& path, std::string* error = nullptr) const;
+
+    const std::vector<RuleEntry>& entries() const { return m_entries; }
+    size_t actionCount() const;
+
+    void add(const std::string& key, const ActionSpec& action);
+    bool remove(const std::string& key);
+    void clear() { m_entries.clear(); }
+
+private:
+    std::vector<RuleEntry> m_entries;
+};
+
+#endif // RULECONFIG_H
@@ -0,0 +1,274 @@
+#include "ruleimage.h"
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <type_traits>
+#include <vector>
+
+namespace {
+
+const char kMagic[8] = {'A', 'T', 'R', 'G', 'I', 'M', 'G', '\0'};
+const uint32_t kByteOrderMark = 0x01020304;
+
+enum Section : uint32_t {
+    SectionStrings,
+    SectionArgIds,
+    SectionActions,
+    SectionGroups,
+    SectionSlots,
+    SectionVidSlots,
+    SectionBuckets,
+    SectionIntervals,
+    SectionMasks,
+    SectionCondNodes,
+    SectionCondEdges,
+    SectionCondAccepts,
+    SectionPortNodes,
+    SectionPortEdges,
+    SectionFingerprints,
+    SectionCount
+};
+
+struct SectionEntry {
+    uint64_t offset;
+    uint64_t count;
+};
+
+struct ImageHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t byte_order;
+    uint32_t section_count;
+    uint64_t file_size;
+    uint64_t source_size;
+    int64_t source_mtime_ns;
+    uint64_t invalid_rules;
+    uint32_t slot_shift;
+    uint32_t vid_slot_shift;
+    uint32_t any_vid_bucket;
+    uint32_t checksum;     // CRC-32 of everything after the header
+    SectionEntry sections[SectionCount];
+};
+
+struct Crc32Table {
+    uint32_t entries[256];
+
+    Crc32Table() {
+        for (uint32_t i = 0; i < 256; ++i) {
+            uint32_t c = i;
+            for (int k = 0; k < 8; ++k) {
+                c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+            }
+            entries[i] = c;
+        }
+    }
+};
+
+uint32_t crc32(const unsigned char* data, size_t len) {
+    static const Crc32Table table;
+    uint32_t crc = 0xffffffffu;
+    for (size_t i = 0; i < len; ++i) {
+        crc = table.entries[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+    }
+    return crc ^ 0xffffffffu;
+}
+
+size_t alignUp(size_t value) {
+    return (value + 7) & ~size_t(7);
+}
+
+bool fail(std::string* error, const std::string& message) {
+    if (error) *error = message;
+    return false;
+}
+
+} // namespace
+
+// Visits every array of the table in section order.
+#define RULEIMAGE_FOR_EACH_SECTION(table, f)       \
+    f(SectionStrings, (table).m_strings);          \
+    f(SectionArgIds, (table).m_argIds);            \
+    f(SectionActions, (table).m_actions);          \
+    f(SectionGroups, (table).m_groups);            \
+    f(SectionSlots, (table).m_slots);              \
+    f(SectionVidSlots, (table).m_vidSlots);        \
+    f(SectionBuckets, (table).m_buckets);          \
+    f(SectionIntervals, (table).m_intervals);      \
+    f(SectionMasks, (table).m_masks);              \
+    f(SectionCondNodes, (table).m_condNodes);      \
+    f(SectionCondEdges, (table).m_condEdges);      \
+    f(SectionCondAccepts, (table).m_condAccepts);  \
+    f(SectionPortNodes, (table).m_portNodes);      \
+    f(SectionPortEdges, (table).m_portEdges);      \
+    f(SectionFingerprints, (table).m_fingerprints)
+
+std::string RuleImage::defaultPathFor(const std::string& configPath) {
+    const std::string suffix = ".json";
+    if (configPath.size() > suffix.size()
+        && configPath.compare(configPath.size() - suffix.size(), suffix.size(), suffix) == 0) {
+        return configPath.substr(0, configPath.size() - suffix.size()) + ".bin";
+    }
+    return configPath + ".bin";
+}
+
+bool RuleImage::stampOf(const std::string& path, SourceStamp& stamp) {
+    struct stat st;
+    if (stat(path.c_str(), &st) != 0) {
+        return false;
+    }
+    stamp.size = uint64_t(st.st_size);
+    stamp.mtime_ns = int64_t(st.st_mtim.tv_sec) * 1000000000 + st.st_mtim.tv_nsec;
+    return true;
+}
+
+bool RuleImage::write(const RuleTable& table, const SourceStamp& source, const std::string& path,
+                      std::string* error) {
+    ImageHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kVersion;
+    header.header_size = sizeof(ImageHeader);
+    header.byte_order = kByteOrderMark;
+    header.section_count = SectionCount;
+    header.source_size = source.size;
+    header.source_mtime_ns = source.mtime_ns;
+    header.invalid_rules = table.m_invalidRules;
+    header.slot_shift = table.m_slotShift;
+    header.vid_slot_shift = table.m_vidSlotShift;
+    header.any_vid_bucket = table.m_anyVidBucket;
+
+    size_t offset = alignUp(sizeof(ImageHeader));
+    auto layout = [&](Section id, const auto& view) {
+        header.sections[id].offset = offset;
+        header.sections[id].count = view.size;
+        offset = alignUp(offset + view.size * sizeof(*view.data));
+    };
+    RULEIMAGE_FOR_EACH_SECTION(table, layout);
+    header.file_size = offset;
+
+    std::vector<unsigned char> buffer(offset, 0);
+    auto copy = [&](Section id, const auto& view) {
+        if (view.size > 0) {
+            memcpy(buffer.data() + header.sections[id].offset, view.data, view.size * sizeof(*view.data));
+        }
+    };
+    RULEIMAGE_FOR_EACH_SECTION(table, copy);
+    header.checksum = crc32(buffer.data() + sizeof(ImageHeader), buffer.size() - sizeof(ImageHeader));
+    memcpy(buffer.data(), &header, sizeof(header));
+
+    std::string tmpPath = path + ".tmp";
+    int fd = ::open(tmpPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return fail(error, "nie mozna utworzyc '" + tmpPath + "': " + strerror(errno));
+    }
+    size_t written = 0;
+    while (written < buffer.size()) {
+        ssize_t n = ::write(fd, buffer.data() + written, buffer.size() - written);
+        if (n < 0) {
+            if (errno == EINTR) continue;
+            int err = errno;
+            close(fd);
+            unlink(tmpPath.c_str());
+            return fail(error, "blad zapisu '" + tmpPath + "': " + strerror(err));
+        }
+        written += size_t(n);
+    }
+    if (fsync(fd) != 0 || close(fd) != 0) {
+        unlink(tmpPath.c_str());
+        return fail(error, "blad zapisu '" + tmpPath + "'");
+    }
+    if (rename(tmpPath.c_str(), path.c_str()) != 0) {
+        int err = errno;
+        unlink(tmpPath.c_str());
+        return fail(error, "nie mozna zapisac '" + path + "': " + strerror(err));
+    }
+    return true;
+}
+
+std::shared_ptr<const RuleTable> RuleImage::open(const std::string& path, const SourceStamp* expected,
+                                                 std::string* error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        fail(error, "nie mozna otworzyc '" + path + "': " + strerror(errno));
+        return nullptr;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || size_t(st.st_size) < sizeof(ImageHeader)) {
+        close(fd);
+        fail(error, "'" + path + "' jest za krotki");
+        return nullptr;
+    }
+    size_t size = size_t(st.st_size);
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fail(error, "mmap '" + path + "': " + strerror(errno));
+        return nullptr;
+    }
+
+    auto reject = [&](const std::string& message) -> std::shared_ptr<const RuleTable> {
+        munmap(map, size);
+        fail(error, "'" + path + "': " + message);
+        return nullptr;
+    };
+
+    const unsigned char* base = static_cast<const unsigned char*>(map);
+    const ImageHeader& header = *reinterpret_cast<const ImageHeader*>(base);
+    if (memcmp(header.magic, kMagic, sizeof(kMagic)) != 0) {
+        return reject("to nie jest obraz regul");
+    }
+    if (header.version != kVersion || header.header_size != sizeof(ImageHeader)
+        || header.section_count != SectionCount) {
+        return reject("nieobslugiwana wersja obrazu");
+    }
+    if (header.byte_order != kByteOrderMark) {
+        return reject("obraz z innej architektury");
+    }
+    if (header.file_size != size) {
+        return reject("niepelny plik");
+    }
+    if (expected && (expected->size != header.source_size || expected->mtime_ns != header.source_mtime_ns)) {
+        return reject("obraz nieaktualny wzgledem zrodla");
+    }
+    if (crc32(base + sizeof(ImageHeader), size - sizeof(ImageHeader)) != header.checksum) {
+        return reject("bledna suma kontrolna");
+    }
+
+    std::shared_ptr<RuleTable> table(new RuleTable(RuleTable::MappedTag()));
+    bool sectionsOk = true;
+    auto bind = [&](Section id, auto& view) {
+        using T = typename std::remove_reference<decltype(*view.data)>::type;
+        const SectionEntry& entry = header.sections[id];
+        if (entry.offset % alignof(T) != 0 || entry.offset > size
+            || entry.count > (size - entry.offset) / sizeof(T)) {
+            sectionsOk = false;
+            return;
+        }
+        view.data = reinterpret_cast<const T*>(base + entry.offset);
+        view.size = entry.count;
+    };
+    RULEIMAGE_FOR_EACH_SECTION(*table, bind);
+    auto slotsOk = [](uint32_t shift, size_t count) {
+        return shift >= 1 && shift <= 28 && count == (size_t(1) << (32 - shift));
+    };
+    if (!sectionsOk || table->m_strings.size == 0
+        || !slotsOk(header.slot_shift, table->m_slots.size)
+        || !slotsOk(header.vid_slot_shift, table->m_vidSlots.size)
+        || (header.any_vid_bucket != RuleTable::kNoBucket && header.any_vid_bucket >= table->m_buckets.size)) {
+        table.reset();
+        return reject("uszkodzone sekcje");
+    }
+    table->m_slotShift = header.slot_shift;
+    table->m_slotMask = uint32_t(table->m_slots.size - 1);
+    table->m_vidSlotShift = header.vid_slot_shift;
+    table->m_vidSlotMask = uint32_t(table->m_vidSlots.size - 1);
+    table->m_anyVidBucket = header.any_vid_bucket;
+    table->m_invalidRules = header.invalid_rules;
+    table->m_map = map;
+    table->m_mapSize = size;
+    return table;
+}
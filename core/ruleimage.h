@@ -0,0 +1,41 @@
+#ifndef RULEIMAGE_H
+#define RULEIMAGE_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include "ruletable.h"
+
+// Precompiled, mmap-able form of a RuleTable ("autotriggers --compile").
+//
+// Layout: a fixed header followed by 8-byte aligned sections holding the
+// table arrays exactly as RuleTable uses them, so a loaded image is used in
+// place. The header records the size and mtime of the JSON it was compiled
+// from; an image whose source changed since is rejected as stale. Images
+// are native-endian and only valid on the architecture that wrote them.
+class RuleImage {
+public:
+    static const uint32_t kVersion = 6;
+
+    struct SourceStamp {
+        uint64_t size = 0;
+        int64_t mtime_ns = 0;
+    };
+
+    // triggers.json -> triggers.bin
+    static std::string defaultPathFor(const std::string& configPath);
+
+    static bool stampOf(const std::string& path, SourceStamp& stamp);
+
+    // Writes to a temporary file and renames it over path, so a daemon that
+    // has the previous image mapped keeps a consistent view.
+    static bool write(const RuleTable& table, const SourceStamp& source, const std::string& path,
+                      std::string* error = nullptr);
+
+    // Maps and validates an image. When expected is set, an image compiled
+    // from a different source is rejected.
+    static std::shared_ptr<const RuleTable> open(const std::string& path, const SourceStamp* expected,
+                                                 std::string* error = nullptr);
+};
+
+#endif // RULEIMAGE_H
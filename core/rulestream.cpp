@@ -0,0 +1,592 @@
+#include "rulestream.h"
+#include "deviceattrs.h"
+#include "usbkey.h"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+namespace {
+
+// Consumed input is dropped from the page cache mapping in steps this big.
+const size_t kReleaseStep = size_t(8) << 20;
+
+inline bool isSpace(char c) {
+    return c == ' ' || c == '\n' || c == '\r' || c == '\t';
+}
+
+// First '"', '\\' or control character in [p, end), or end.
+inline const char* scanStringRun(const char* p, const char* end) {
+#if defined(__SSE2__)
+    const __m128i quote = _mm_set1_epi8('"');
+    const __m128i backslash = _mm_set1_epi8('\\');
+    const __m128i control = _mm_set1_epi8(0x1f);
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i special = _mm_or_si128(_mm_cmpeq_epi8(v, quote), _mm_cmpeq_epi8(v, backslash));
+        special = _mm_or_si128(special, _mm_cmpeq_epi8(_mm_min_epu8(v, control), v));
+        int mask = _mm_movemask_epi8(special);
+        if (mask) {
+            return p + __builtin_ctz(unsigned(mask));
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && *p != '"' && *p != '\\' && static_cast<unsigned char>(*p) >= 0x20) {
+        ++p;
+    }
+    return p;
+}
+
+inline const char* skipSpace(const char* p, const char* end) {
+    if (p == end || !isSpace(*p)) {
+        return p;
+    }
+#if defined(__SSE2__)
+    // Indentation of pretty-printed files comes in long runs.
+    const __m128i space = _mm_set1_epi8(' ');
+    const __m128i newline = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i tab = _mm_set1_epi8('\t');
+    while (end - p >= 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        __m128i ws = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(v, space), _mm_cmpeq_epi8(v, newline)),
+                                  _mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, tab)));
+        int mask = ~_mm_movemask_epi8(ws) & 0xffff;
+        if (mask) {
+            return p + __builtin_ctz(unsigned(mask));
+        }
+        p += 16;
+    }
+#endif
+    while (p < end && isSpace(*p)) {
+        ++p;
+    }
+    return p;
+}
+
+void appendUtf8(std::string& out, uint32_t cp) {
+    if (cp < 0x80) {
+        out += char(cp);
+    } else if (cp < 0x800) {
+        out += char(0xc0 | (cp >> 6));
+        out += char(0x80 | (cp & 0x3f));
+    } else if (cp < 0x10000) {
+        out += char(0xe0 | (cp >> 12));
+        out += char(0x80 | ((cp >> 6) & 0x3f));
+        out += char(0x80 | (cp & 0x3f));
+    } else {
+        out += char(0xf0 | (cp >> 18));
+        out += char(0x80 | ((cp >> 12) & 0x3f));
+        out += char(0x80 | ((cp >> 6) & 0x3f));
+        out += char(0x80 | (cp & 0x3f));
+    }
+}
+
+class Parser {
+public:
+    Parser(const char* data, size_t size, bool releasable)
+        : m_begin(data), m_p(data), m_end(data + size), m_released(data), m_releasable(releasable) {
+    }
+
+    bool run(const RuleStreamReader::GroupHandler& handler);
+    std::string error() const;
+
+private:
+    bool fail(const char* message) {
+        if (!m_error) {
+            m_error = message;
+            m_errorPos = m_p;
+        }
+        return false;
+    }
+
+    bool consume(char c) {
+        m_p = skipSpace(m_p, m_end);
+        if (m_p < m_end && *m_p == c) {
+            ++m_p;
+            return true;
+        }
+        return false;
+    }
+
+    char peek() {
+        m_p = skipSpace(m_p, m_end);
+        return m_p < m_end ? *m_p : '\0';
+    }
+
+    bool literal(const char* word) {
+        size_t len = strlen(word);
+        if (size_t(m_end - m_p) < len || memcmp(m_p, word, len) != 0) {
+            return fail("nieznana wartosc");
+        }
+        m_p += len;
+        return true;
+    }
+
+    bool parseString(std::string& out);
+    bool parseEscape(std::string& out);
+    bool parseHex4(uint32_t& out);
+    bool scanNumber(const char*& begin, const char*& end, bool& integral);
+    bool parseInt(int& out);
+    bool parseBool(bool& out);
+    bool parseStringArray(std::vector<std::string>& out);
+    bool parseMatch(std::vector<std::pair<std::string, std::string>>& out);
+    bool parseAction(ActionSpec& out);
+    bool skipValue(int depth);
+    void release();
+
+    const char* m_begin;
+    const char* m_p;
+    const char* m_end;
+    const char* m_released;
+    bool m_releasable;
+    const char* m_error = nullptr;
+    const char* m_errorPos = nullptr;
+
+    std::string m_key;
+    std::string m_field;
+    std::string m_value;
+    std::vector<ActionSpec> m_actions;
+};
+
+std::string Parser::error() const {
+    size_t line = 1;
+    for (const char* p = m_begin; p < m_errorPos; ++p) {
+        line += *p == '\n';
+    }
+    return std::string(m_error ? m_error : "blad") + " (linia " + std::to_string(line) + ")";
+}
+
+bool Parser::parseHex4(uint32_t& out) {
+    if (m_end - m_p < 4) {
+        return fail("niepelna sekwencja \\u");
+    }
+    out = 0;
+    for (int i = 0; i < 4; ++i) {
+        int d = hexDigitValue(m_p[i]);
+        if (d < 0) {
+            return fail("nieprawidlowa sekwencja \\u");
+        }
+        out = (out << 4) | uint32_t(d);
+    }
+    m_p += 4;
+    return true;
+}
+
+bool Parser::parseEscape(std::string& out) {
+    ++m_p;
+    if (m_p == m_end) {
+        return fail("niezakonczony napis");
+    }
+    char c = *m_p++;
+    switch (c) {
+    case '"': out += '"'; return true;
+    case '\\': out += '\\'; return true;
+    case '/': out += '/'; return true;
+    case 'b': out += '\b'; return true;
+    case 'f': out += '\f'; return true;
+    case 'n': out += '\n'; return true;
+    case 'r': out += '\r'; return true;
+    case 't': out += '\t'; return true;
+    case 'u': {
+        uint32_t cp;
+        if (!parseHex4(cp)) {
+            return false;
+        }
+        if (cp >= 0xd800 && cp <= 0xdbff) {
+            uint32_t low;
+            if (m_end - m_p < 2 || m_p[0] != '\\' || m_p[1] != 'u') {
+                return fail("nieprawidlowa para surogatow");
+            }
+            m_p += 2;
+            if (!parseHex4(low) || low < 0xdc00 || low > 0xdfff) {
+                return fail("nieprawidlowa para surogatow");
+            }
+            cp = 0x10000 + ((cp - 0xd800) << 10) + (low - 0xdc00);
+        } else if (cp >= 0xdc00 && cp <= 0xdfff) {
+            return fail("nieprawidlowa para surogatow");
+        }
+        appendUtf8(out, cp);
+        return true;
+    }
+    default:
+        return fail("nieprawidlowa sekwencja ucieczki");
+    }
+}
+
+bool Parser::parseString(std::string& out) {
+    if (!consume('"')) {
+        return fail("oczekiwano napisu");
+    }
+    out.clear();
+    for (;;) {
+        const char* run = m_p;
+        m_p = scanStringRun(m_p, m_end);
+        out.append(run, size_t(m_p - run));
+        if (m_p == m_end) {
+            return fail("niezakonczony napis");
+        }
+        if (*m_p == '"') {
+            ++m_p;
+            return true;
+        }
+        if (*m_p == '\\') {
+            if (!parseEscape(out)) {
+                return false;
+            }
+            continue;
+        }
+        return fail("znak sterujacy w napisie");
+    }
+}
+
+bool Parser::scanNumber(const char*& begin, const char*& end, bool& integral) {
+    m_p = skipSpace(m_p, m_end);
+    begin = m_p;
+    integral = true;
+    const char* p = m_p;
+    if (p < m_end && *p == '-') {
+        ++p;
+    }
+    const char* digits = p;
+    while (p < m_end && *p >= '0' && *p <= '9') {
+        ++p;
+    }
+    if (p == digits || (*digits == '0' && p - digits > 1)) {
+        return fail("nieprawidlowa liczba");
+    }
+    if (p < m_end && *p == '.') {
+        integral = false;
+        const char* frac = ++p;
+        while (p < m_end && *p >= '0' && *p <= '9') {
+            ++p;
+        }
+        if (p == frac) {
+            return fail("nieprawidlowa liczba");
+        }
+    }
+    if (p < m_end && (*p == 'e' || *p == 'E')) {
+        integral = false;
+        ++p;
+        if (p < m_end && (*p == '+' || *p == '-')) {
+            ++p;
+        }
+        const char* exp = p;
+        while (p < m_end && *p >= '0' && *p <= '9') {
+            ++p;
+        }
+        if (p == exp) {
+            return fail("nieprawidlowa liczba");
+        }
+    }
+    end = m_p = p;
+    return true;
+}
+
+bool Parser::parseInt(int& out) {
+    char c = peek();
+    if (c == 'n') {
+        return literal("null");
+    }
+    if (c != '-' && (c < '0' || c > '9')) {
+        return fail("oczekiwano liczby");
+    }
+    const char* begin;
+    const char* end;
+    bool integral;
+    if (!scanNumber(begin, end, integral)) {
+        return false;
+    }
+    char buf[64];
+    size_t len = std::min(size_t(end - begin), sizeof(buf) - 1);
+    memcpy(buf, begin, len);
+    buf[len] = '\0';
+    double value = integral ? double(strtoll(buf, nullptr, 10)) : strtod(buf, nullptr);
+    out = value > INT_MAX ? INT_MAX : value < INT_MIN ? INT_MIN : int(value);
+    return true;
+}
+
+bool Parser::parseBool(bool& out) {
+    switch (peek()) {
+    case 't': out = true; return literal("true");
+    case 'f': out = false; return literal("false");
+    case 'n': return literal("null");
+    default: return fail("oczekiwano wartosci logicznej");
+    }
+}
+
+bool Parser::parseStringArray(std::vector<std::string>& out) {
+    out.clear();
+    if (peek() == 'n') {
+        return literal("null");
+    }
+    if (!consume('[')) {
+        return fail("oczekiwano tablicy napisow");
+    }
+    if (consume(']')) {
+        return true;
+    }
+    do {
+        out.emplace_back();
+        if (!parseString(out.back())) {
+            return false;
+        }
+    } while (consume(','));
+    return consume(']') || fail("oczekiwano ']'");
+}
+
+// JSON numbers are accepted for classes (as their value) and busnum.
+bool Parser::parseMatch(std::vector<std::pair<std::string, std::string>>& out) {
+    out.clear();
+    if (peek() == 'n') {
+        return literal("null");
+    }
+    if (!consume('{')) {
+        return fail("oczekiwano obiektu \"match\"");
+    }
+    if (consume('}')) {
+        return true;
+    }
+    do {
+        out.emplace_back();
+        std::pair<std::string, std::string>& condition = out.back();
+        if (!parseString(condition.first) || !(consume(':') || fail("oczekiwano ':'"))) {
+            return false;
+        }
+        char c = peek();
+        if (c == '"') {
+            if (!parseString(condition.second)) {
+                return false;
+            }
+        } else if (c == '-' || (c >= '0' && c <= '9')) {
+            const char* begin;
+            const char* end;
+            bool integral;
+            if (!scanNumber(begin, end, integral)) {
+                return false;
+            }
+            if (integral && *begin != '-') {
+                condition.second = formatAttrNumber(condition.first, strtoull(begin, nullptr, 10));
+            } else {
+                condition.second.assign(begin, end);
+            }
+        } else {
+            // Anything else can't match; keep its text so the rule is rejected.
+            const char* begin = m_p;
+            if (!skipValue(0)) {
+                return false;
+            }
+            condition.second.assign(begin, m_p);
+        }
+    } while (consume(','));
+    return consume('}') || fail("oczekiwano '}'");
+}
+
+bool Parser::parseAction(ActionSpec& out) {
+    out.script.clear();
+    out.args.clear();
+    out.auth_required = false;
+    out.delay_sec = 0;
+    out.max_concurrent = 0;
+    out.drop_overflow = false;
+    out.match.clear();
+    if (!consume('{')) {
+        return fail("oczekiwano obiektu akcji");
+    }
+    if (consume('}')) {
+        return true;
+    }
+    do {
+        if (!parseString(m_field) || !(consume(':') || fail("oczekiwano ':'"))) {
+            return false;
+        }
+        bool ok;
+        if (m_field == "action_script") {
+            ok = peek() == 'n' ? literal("null") : parseString(out.script);
+        } else if (m_field == "action_args") {
+            ok = parseStringArray(out.args);
+        } else if (m_field == "auth_required") {
+            ok = parseBool(out.auth_required);
+        } else if (m_field == "delay_sec") {
+            ok = parseInt(out.delay_sec);
+        } else if (m_field == "max_concurrent") {
+            ok = parseInt(out.max_concurrent);
+        } else if (m_field == "overflow") {
+            ok = parseString(m_value)
+                 && ((m_value == "drop" || m_value == "queue") || fail("overflow: oczekiwano \"drop\" lub \"queue\""));
+            out.drop_overflow = m_value == "drop";
+        } else if (m_field == "match") {
+            ok = parseMatch(out.match);
+        } else {
+            ok = skipValue(0);
+        }
+        if (!ok) {
+            return false;
+        }
+    } while (consume(','));
+    return consume('}') || fail("oczekiwano '}'");
+}
+
+bool Parser::skipValue(int depth) {
+    if (depth > 256) {
+        return fail("zbyt gleboko zagniezdzony JSON");
+    }
+    char c = peek();
+    switch (c) {
+    case '"':
+        return parseString(m_field);
+    case '{':
+        ++m_p;
+        if (consume('}')) {
+            return true;
+        }
+        do {
+            if (!parseString(m_field) || !(consume(':') || fail("oczekiwano ':'")) || !skipValue(depth + 1)) {
+                return false;
+            }
+        } while (consume(','));
+        return consume('}') || fail("oczekiwano '}'");
+    case '[':
+        ++m_p;
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            if (!skipValue(depth + 1)) {
+                return false;
+            }
+        } while (consume(','));
+        return consume(']') || fail("oczekiwano ']'");
+    case 't':
+        return literal("true");
+    case 'f':
+        return literal("false");
+    case 'n':
+        return literal("null");
+    default: {
+        const char* begin;
+        const char* end;
+        bool integral;
+        return scanNumber(begin, end, integral);
+    }
+    }
+}
+
+// Drops pages the parser is done with. The mapping is read-only and private,
+// so the kernel just discards them.
+void Parser::release() {
+    if (!m_releasable || size_t(m_p - m_released) < kReleaseStep) {
+        return;
+    }
+    const uintptr_t page = uintptr_t(sysconf(_SC_PAGESIZE));
+    uintptr_t from = uintptr_t(m_released) & ~(page - 1);
+    uintptr_t to = uintptr_t(m_p) & ~(page - 1);
+    if (to > from) {
+        madvise(reinterpret_cast<void*>(from), to - from, MADV_DONTNEED);
+        m_released = reinterpret_cast<const char*>(to);
+    }
+}
+
+bool Parser::run(const RuleStreamReader::GroupHandler& handler) {
+    if (m_end - m_p >= 3 && memcmp(m_p, "\xef\xbb\xbf", 3) == 0) {
+        m_p += 3;
+    }
+    if (!consume('{')) {
+        return fail("plik nie jest obiektem JSON");
+    }
+    if (!consume('}')) {
+        do {
+            if (!parseString(m_key) || !(consume(':') || fail("oczekiwano ':'"))) {
+                return false;
+            }
+            if (peek() != '[') {
+                if (!skipValue(0)) {
+                    return false;
+                }
+                continue;
+            }
+            ++m_p;
+            size_t count = 0;
+            if (!consume(']')) {
+                do {
+                    // Elements are reused so their strings keep their capacity.
+                    if (count == m_actions.size()) {
+                        m_actions.emplace_back();
+                    }
+                    if (!parseAction(m_actions[count++])) {
+                        return false;
+                    }
+                } while (consume(','));
+                if (!consume(']')) {
+                    return fail("oczekiwano ']'");
+                }
+            }
+            m_actions.resize(count);
+            handler(m_key, m_actions);
+            release();
+        } while (consume(','));
+        if (!consume('}')) {
+            return fail("oczekiwano '}'");
+        }
+    }
+    if (skipSpace(m_p, m_end) != m_end) {
+        m_p = skipSpace(m_p, m_end);
+        return fail("nadmiarowe dane po obiekcie JSON");
+    }
+    return true;
+}
+
+} // namespace
+
+bool RuleStreamReader::readBuffer(const char* data, size_t size, const GroupHandler& handler, std::string* error) {
+    Parser parser(data, size, false);
+    if (!parser.run(handler)) {
+        if (error) *error = parser.error();
+        return false;
+    }
+    return true;
+}
+
+bool RuleStreamReader::readFile(const std::string& path, const GroupHandler& handler, std::string* error) {
+    int fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        if (error) *error = "nie mozna otworzyc '" + path + "'";
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0) {
+        close(fd);
+        if (error) *error = "nie mozna odczytac '" + path + "'";
+        return false;
+    }
+    size_t size = size_t(st.st_size);
+    if (size == 0) {
+        close(fd);
+        if (error) *error = "'" + path + "' jest pusty";
+        return false;
+    }
+    void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        if (error) *error = "mmap '" + path + "': " + strerror(errno);
+        return false;
+    }
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    Parser parser(static_cast<const char*>(map), size, true);
+    bool ok = parser.run(handler);
+    if (!ok && error) {
+        *error = "'" + path + "': " + parser.error();
+    }
+    munmap(map, size);
+    return ok;
+}
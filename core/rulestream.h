@@ -0,0 +1,27 @@
+#ifndef RULESTREAM_H
+#define RULESTREAM_H
+
+#include <cstddef>
+#include <functional>
+#include <string>
+#include <vector>
+#include "ruleconfig.h"
+
+// Streaming reader for triggers.json. Walks the file once, straight from an
+// mmap, and hands every key with its actions to a callback, so no JSON DOM
+// is ever built and memory stays at what the consumer keeps. String and
+// whitespace runs are scanned 16 bytes at a time with SSE2 where available.
+//
+// Only the triggers.json schema is understood: unknown fields are skipped,
+// a key whose value isn't an array is ignored, a field of the wrong type is
+// an error. Consumed parts of the mapping are released as the reader goes.
+class RuleStreamReader {
+public:
+    // actions is reused between calls; copy what you need to keep.
+    using GroupHandler = std::function<void(const std::string& key, const std::vector<ActionSpec>& actions)>;
+
+    static bool readFile(const std::string& path, const GroupHandler& handler, std::string* error = nullptr);
+    static bool readBuffer(const char* data, size_t size, const GroupHandler& handler, std::string* error = nullptr);
+};
+
+#endif // RULESTREAM_H
@@ -0,0 +1,715 @@
+#include "ruletable.h"
+#include "ruleimage.h"
+#include "portpath.h"
+#include "rulestream.h"
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <sys/mman.h>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t kMinSlotBits = 4;
+const char kPortPrefix[] = "port:";
+const size_t kPortPrefixLen = sizeof(kPortPrefix) - 1;
+
+// Priority: fixed VID before "*", then narrower PID sets, then config order.
+uint64_t patternPriority(const UsbPattern& pattern, size_t order) {
+    return (uint64_t(pattern.any_vid ? 1 : 0) << 49) | (uint64_t(pattern.span()) << 32) | uint32_t(order);
+}
+
+// Port patterns come after all VID:PID ones: deeper ports first, exact before "*".
+uint64_t portPriority(const std::string& path, bool prefix, size_t order) {
+    uint64_t depth = std::min<uint64_t>(uint64_t(std::count(path.begin(), path.end(), '/')) + 1, 255);
+    return (uint64_t(1) << 50) | ((255 - depth) << 33) | (uint64_t(prefix ? 1 : 0) << 32) | uint32_t(order);
+}
+
+} // namespace
+
+RuleTable::RuleTable()
+    : m_slotMask((1u << kMinSlotBits) - 1),
+      m_slotShift(32 - kMinSlotBits),
+      m_vidSlotMask((1u << kMinSlotBits) - 1),
+      m_vidSlotShift(32 - kMinSlotBits),
+      m_storage(new Storage()) {
+    m_storage->strings.assign(1, '\0');
+    m_storage->slots.assign(size_t(1) << kMinSlotBits, Slot{0, 0});
+    m_storage->vidSlots.assign(size_t(1) << kMinSlotBits, Slot{0, 0});
+    bindStorage();
+}
+
+RuleTable::RuleTable(MappedTag)
+    : m_slotMask(0),
+      m_slotShift(32),
+      m_vidSlotMask(0),
+      m_vidSlotShift(32) {
+}
+
+RuleTable::~RuleTable() {
+    if (m_map) {
+        munmap(m_map, m_mapSize);
+    }
+}
+
+void RuleTable::bindStorage() {
+    m_strings = {m_storage->strings.data(), m_storage->strings.size()};
+    m_argIds = {m_storage->argIds.data(), m_storage->argIds.size()};
+    m_actions = {m_storage->actions.data(), m_storage->actions.size()};
+    m_groups = {m_storage->groups.data(), m_storage->groups.size()};
+    m_slots = {m_storage->slots.data(), m_storage->slots.size()};
+    m_vidSlots = {m_storage->vidSlots.data(), m_storage->vidSlots.size()};
+    m_buckets = {m_storage->buckets.data(), m_storage->buckets.size()};
+    m_intervals = {m_storage->intervals.data(), m_storage->intervals.size()};
+    m_masks = {m_storage->masks.data(), m_storage->masks.size()};
+    m_condNodes = {m_storage->condNodes.data(), m_storage->condNodes.size()};
+    m_condEdges = {m_storage->condEdges.data(), m_storage->condEdges.size()};
+    m_condAccepts = {m_storage->condAccepts.data(), m_storage->condAccepts.size()};
+    m_portNodes = {m_storage->portNodes.data(), m_storage->portNodes.size()};
+    m_portEdges = {m_storage->portEdges.data(), m_storage->portEdges.size()};
+    m_fingerprints = {m_storage->fingerprints.data(), m_storage->fingerprints.size()};
+}
+
+std::shared_ptr<const RuleTable> RuleTable::fromFile(const std::string& path, std::string* error) {
+    // Streamed straight into the builder; the config is never held in memory.
+    RuleTableBuilder builder;
+    bool ok = RuleStreamReader::readFile(path, [&builder](const std::string& key, const std::vector<ActionSpec>& actions) {
+        builder.addGroup(key, actions);
+    }, error);
+    if (!ok) {
+        return nullptr;
+    }
+    return builder.finish();
+}
+
+std::shared_ptr<const RuleTable> RuleTable::fromConfig(const RuleConfig& config) {
+    RuleTableBuilder builder;
+    for (const RuleEntry& entry : config.entries()) {
+        builder.addGroup(entry.key, entry.actions);
+    }
+    return builder.finish();
+}
+
+std::shared_ptr<const RuleTable> RuleTable::load(const std::string& configPath, const std::string& imagePath,
+                                                 std::string* error, RuleLoadInfo* info) {
+    if (info) *info = RuleLoadInfo();
+    if (!imagePath.empty() && access(imagePath.c_str(), F_OK) == 0) {
+        RuleImage::SourceStamp stamp;
+        bool haveSource = RuleImage::stampOf(configPath, stamp);
+        std::string imageError;
+        std::shared_ptr<const RuleTable> table = RuleImage::open(imagePath, haveSource ? &stamp : nullptr, &imageError);
+        if (table) {
+            if (info) info->used_image = true;
+            return table;
+        }
+        if (info) info->image_error = imageError;
+    }
+    return fromFile(configPath, error);
+}
+
+void RuleTable::addMatch(uint32_t group, RuleMatches& out) const {
+    const Group& g = m_groups[group];
+    out.add(RuleMatch{g.priority, g.pattern, g.tree, groupActions(g), g.fingerprint});
+}
+
+void RuleTable::matchBucket(const Bucket& bucket, uint16_t pid, RuleMatches& out) const {
+    // Stabbing query on the implicit interval tree: O(log n + matches).
+    struct Span {
+        uint32_t l, r;
+    };
+    Span stack[64];
+    size_t depth = 0;
+    const Interval* nodes = m_intervals.data + bucket.interval_begin;
+    stack[depth++] = Span{0, bucket.interval_count};
+    while (depth > 0) {
+        Span span = stack[--depth];
+        if (span.l >= span.r) {
+            continue;
+        }
+        uint32_t mid = span.l + (span.r - span.l) / 2;
+        const Interval& node = nodes[mid];
+        if (node.max_hi < pid) {
+            continue;
+        }
+        stack[depth++] = Span{span.l, mid};
+        if (node.lo <= pid) {
+            if (pid <= node.hi) {
+                addMatch(node.group, out);
+            }
+            stack[depth++] = Span{mid + 1, span.r};
+        }
+    }
+
+    const MaskEntry* masks = m_masks.data + bucket.mask_begin;
+    for (uint32_t i = 0; i < bucket.mask_count; ++i) {
+        if ((pid & masks[i].mask) == masks[i].value) {
+            addMatch(masks[i].group, out);
+        }
+    }
+}
+
+void RuleTable::match(uint32_t key, RuleMatches& out) const {
+    out.clear();
+    uint32_t group = probe(m_slots, m_slotShift, m_slotMask, key);
+    if (group) {
+        addMatch(group - 1, out);
+    }
+    if (m_buckets.size == 0) {
+        return;
+    }
+    uint16_t pid = usbKeyPid(key);
+    uint32_t bucket = probe(m_vidSlots, m_vidSlotShift, m_vidSlotMask, usbKeyVid(key));
+    if (bucket) {
+        matchBucket(m_buckets[bucket - 1], pid, out);
+    }
+    if (m_anyVidBucket != kNoBucket) {
+        matchBucket(m_buckets[m_anyVidBucket], pid, out);
+    }
+}
+
+void RuleTable::match(uint32_t key, const char* devpath, RuleMatches& out) const {
+    match(key, out);
+    matchPort(devpath, out);
+}
+
+void RuleTable::matchPort(const char* devpath, RuleMatches& out) const {
+    const char* comp = findPortPath(devpath);
+    if (!comp || m_portNodes.size == 0) {
+        return;
+    }
+    uint32_t node = 0;
+    for (;;) {
+        const char* slash = strchr(comp, '/');
+        size_t len = slash ? size_t(slash - comp) : strlen(comp);
+        const PortNode& parent = m_portNodes[node];
+        const PortEdge* edges = m_portEdges.data + parent.edge_begin;
+        const PortEdge* last = edges + parent.edge_count;
+        const PortEdge* it = std::lower_bound(edges, last, comp, [this, len](const PortEdge& edge, const char* c) {
+            return comparePortComponent(string(edge.component), c, len) < 0;
+        });
+        if (it == last || comparePortComponent(string(it->component), comp, len) != 0) {
+            return;
+        }
+        node = it->child;
+        const PortNode& child = m_portNodes[node];
+        if (child.prefix_group) {
+            addMatch(child.prefix_group - 1, out);
+        }
+        if (!slash) {
+            if (child.exact_group) {
+                addMatch(child.exact_group - 1, out);
+            }
+            return;
+        }
+        comp = slash + 1;
+    }
+}
+
+void RuleTable::selectNode(uint32_t index, const CompiledAction* actions, DeviceAttrs& attrs,
+                           ActionSelection& out) const {
+    const CondNode& node = m_condNodes[index];
+    for (uint32_t i = 0; i < node.accept_count; ++i) {
+        out.add(actions + m_condAccepts[node.accept_begin + i]);
+    }
+    if (node.attr == kNoAttr) {
+        return;
+    }
+    if (node.rest) {
+        selectNode(node.rest - 1, actions, attrs, out);
+    }
+    DeviceAttr attr = DeviceAttr(node.attr);
+    const CondEdge* edges = m_condEdges.data + node.edge_begin;
+    forEachAttrValue(attr, attrs.get(attr), [&](const char* value) {
+        const CondEdge* it = std::lower_bound(edges, edges + node.edge_count, value,
+                                              [this](const CondEdge& edge, const char* v) {
+                                                  return strcmp(string(edge.value), v) < 0;
+                                              });
+        if (it != edges + node.edge_count && strcmp(string(it->value), value) == 0) {
+            selectNode(it->child, actions, attrs, out);
+        }
+        return true;
+    });
+}
+
+void RuleTable::select(const RuleMatch& match, DeviceAttrs& attrs, ActionSelection& out) const {
+    out.clear();
+    if (match.tree == 0) {
+        for (const CompiledAction& action : match.actions) {
+            out.add(&action);
+        }
+        return;
+    }
+    selectNode(match.tree - 1, match.actions.first, attrs, out);
+    // Nodes emit in tree order; callers expect config order.
+    std::sort(out.data(), out.data() + out.m_size);
+}
+
+bool RuleTable::containsGroup(uint64_t fingerprint) const {
+    const uint64_t* end = m_fingerprints.data + m_fingerprints.size;
+    return std::binary_search(m_fingerprints.data, end, fingerprint);
+}
+
+RuleDiff RuleTable::diff(const RuleTable& before, const RuleTable& after) {
+    RuleDiff result;
+    size_t i = 0, j = 0;
+    while (i < before.m_fingerprints.size && j < after.m_fingerprints.size) {
+        uint64_t a = before.m_fingerprints[i];
+        uint64_t b = after.m_fingerprints[j];
+        if (a == b) {
+            ++result.kept;
+            ++i;
+            ++j;
+        } else if (a < b) {
+            ++result.removed;
+            ++i;
+        } else {
+            ++result.added;
+            ++j;
+        }
+    }
+    result.removed += before.m_fingerprints.size - i;
+    result.added += after.m_fingerprints.size - j;
+    return result;
+}
+
+bool RuleTable::usbPatterns(std::vector<UsbPattern>& out) const {
+    out.clear();
+    for (size_t i = 0; i < m_groups.size; ++i) {
+        const char* text = string(m_groups[i].pattern);
+        if (strncmp(text, kPortPrefix, kPortPrefixLen) == 0) {
+            return false;
+        }
+        UsbPattern pattern;
+        if (parseUsbPattern(text, pattern)) {
+            out.push_back(pattern);
+        }
+    }
+    return true;
+}
+
+size_t RuleTable::memoryUsage() const {
+    if (m_map) {
+        return m_mapSize;
+    }
+    return m_strings.size + m_argIds.size * sizeof(uint32_t)
+         + m_actions.size * sizeof(CompiledAction) + m_groups.size * sizeof(Group)
+         + (m_slots.size + m_vidSlots.size) * sizeof(Slot) + m_buckets.size * sizeof(Bucket)
+         + m_intervals.size * sizeof(Interval) + m_masks.size * sizeof(MaskEntry)
+         + m_condNodes.size * sizeof(CondNode) + m_condEdges.size * sizeof(CondEdge)
+         + m_condAccepts.size * sizeof(uint32_t)
+         + m_portNodes.size * sizeof(PortNode) + m_portEdges.size * sizeof(PortEdge)
+         + m_fingerprints.size * sizeof(uint64_t);
+}
+
+namespace {
+
+// Open addressing with linear probing, load factor at or below 50%.
+template <typename Slot>
+void buildSlots(const std::vector<std::pair<uint32_t, uint32_t>>& entries, std::vector<Slot>& slots,
+                uint32_t& shift, uint32_t& mask) {
+    uint32_t bits = kMinSlotBits;
+    while ((size_t(1) << bits) < entries.size() * 2) {
+        ++bits;
+    }
+    slots.assign(size_t(1) << bits, Slot{0, 0});
+    mask = (1u << bits) - 1;
+    shift = 32 - bits;
+    for (const auto& entry : entries) {
+        uint32_t slot = (entry.first * 0x9e3779b1u) >> shift;
+        while (slots[slot].value != 0) {
+            slot = (slot + 1) & mask;
+        }
+        slots[slot] = Slot{entry.first, entry.second + 1};
+    }
+}
+
+template <typename Interval>
+uint16_t buildIntervalTree(Interval* nodes, size_t l, size_t r) {
+    if (l >= r) {
+        return 0;
+    }
+    size_t mid = l + (r - l) / 2;
+    uint16_t maxHi = nodes[mid].hi;
+    maxHi = std::max(maxHi, buildIntervalTree(nodes, l, mid));
+    maxHi = std::max(maxHi, buildIntervalTree(nodes, mid + 1, r));
+    nodes[mid].max_hi = maxHi;
+    return maxHi;
+}
+
+// 64-bit FNV-1a over one field; the terminator keeps field boundaries apart.
+uint64_t mixFingerprint(uint64_t h, const char* data, size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        h = (h ^ uint8_t(data[i])) * 1099511628211ull;
+    }
+    return (h ^ 0xffu) * 1099511628211ull;
+}
+
+uint64_t mixFingerprint(uint64_t h, const std::string& str) {
+    return mixFingerprint(h, str.data(), str.size());
+}
+
+uint64_t mixFingerprint(uint64_t h, int64_t value) {
+    char buf[sizeof(value)];
+    memcpy(buf, &value, sizeof(value));
+    return mixFingerprint(h, buf, sizeof(buf));
+}
+
+// FNV-1a; the pool strings are NUL-terminated.
+size_t hashString(const char* str) {
+    uint32_t h = 2166136261u;
+    for (; *str; ++str) {
+        h = (h ^ uint8_t(*str)) * 16777619u;
+    }
+    return h;
+}
+
+} // namespace
+
+RuleTableBuilder::RuleTableBuilder()
+    : m_table(new RuleTable()) {
+}
+
+// Open addressing over pool offsets, so every string is stored once, in the pool.
+uint32_t RuleTableBuilder::intern(const std::string& str) {
+    std::vector<char>& pool = m_table->m_storage->strings;
+    if ((m_internCount + 1) * 2 > m_internSlots.size()) {
+        std::vector<uint32_t> slots(std::max<size_t>(64, m_internSlots.size() * 2), 0);
+        size_t mask = slots.size() - 1;
+        for (uint32_t slot : m_internSlots) {
+            if (slot) {
+                size_t i = hashString(pool.data() + slot - 1) & mask;
+                while (slots[i]) i = (i + 1) & mask;
+                slots[i] = slot;
+            }
+        }
+        m_internSlots.swap(slots);
+    }
+    size_t mask = m_internSlots.size() - 1;
+    size_t i = hashString(str.c_str()) & mask;
+    for (; m_internSlots[i]; i = (i + 1) & mask) {
+        uint32_t id = m_internSlots[i] - 1;
+        if (strcmp(pool.data() + id, str.c_str()) == 0) {
+            return id;
+        }
+    }
+    uint32_t id = uint32_t(pool.size());
+    pool.insert(pool.end(), str.begin(), str.end());
+    pool.push_back('\0');
+    m_internSlots[i] = id + 1;
+    ++m_internCount;
+    return id;
+}
+
+bool RuleTableBuilder::addGroup(const std::string& pattern, const std::vector<ActionSpec>& actions) {
+    PendingGroup pending{std::string(), false, UsbPattern(), std::string(), false, 0, {}, {}};
+    if (pattern.compare(0, kPortPrefixLen, kPortPrefix) == 0) {
+        pending.is_port = true;
+        if (!parsePortPattern(pattern.substr(kPortPrefixLen), pending.port_path, pending.port_prefix)) {
+            ++m_table->m_invalidRules;
+            return false;
+        }
+        pending.text = kPortPrefix + pending.port_path + (pending.port_prefix ? "*" : "");
+    } else {
+        if (!parseUsbPattern(pattern, pending.pattern)) {
+            ++m_table->m_invalidRules;
+            return false;
+        }
+        pending.text = formatUsbPattern(pending.pattern);
+    }
+
+    auto it = m_groupByPattern.find(pending.text);
+    if (it == m_groupByPattern.end()) {
+        it = m_groupByPattern.emplace(pending.text, m_pending.size()).first;
+        pending.fingerprint = mixFingerprint(14695981039346656037ull, pending.text);
+        m_pending.push_back(std::move(pending));
+    }
+    PendingGroup& group = m_pending[it->second];
+
+    std::vector<Condition> conditions;
+    for (const ActionSpec& spec : actions) {
+        if (!compileConditions(spec, conditions)) {
+            ++m_table->m_invalidRules;
+            continue;
+        }
+        if (!conditions.empty()) {
+            group.conditional.push_back(CondItem{uint32_t(group.actions.size()), conditions});
+        }
+        CompiledAction action;
+        action.script = intern(spec.script);
+        action.args_begin = uint32_t(m_table->m_storage->argIds.size());
+        action.args_count = uint16_t(spec.args.size());
+        action.flags = (spec.auth_required ? CompiledAction::AuthRequired : 0)
+                     | (spec.drop_overflow ? CompiledAction::DropOverflow : 0);
+        action.delay_sec = spec.delay_sec;
+        action.max_concurrent = uint32_t(std::max(spec.max_concurrent, 0));
+        for (size_t i = 0; i < action.args_count; ++i) {
+            m_table->m_storage->argIds.push_back(intern(spec.args[i]));
+        }
+        group.actions.push_back(action);
+
+        uint64_t& fp = group.fingerprint;
+        fp = mixFingerprint(mixFingerprint(fp, spec.script), int64_t(action.flags) << 32 | uint32_t(action.delay_sec));
+        fp = mixFingerprint(fp, int64_t(action.max_concurrent));
+        fp = mixFingerprint(fp, int64_t(spec.args.size()));
+        for (const std::string& arg : spec.args) {
+            fp = mixFingerprint(fp, arg);
+        }
+        fp = mixFingerprint(fp, int64_t(conditions.size()));
+        for (const Condition& c : conditions) {
+            const char* value = m_table->m_storage->strings.data() + c.value;
+            fp = mixFingerprint(mixFingerprint(fp, int64_t(c.attr)), value, strlen(value));
+        }
+    }
+    return true;
+}
+
+bool RuleTableBuilder::compileConditions(const ActionSpec& spec, std::vector<Condition>& out) {
+    out.clear();
+    std::string value;
+    for (const auto& [name, text] : spec.match) {
+        DeviceAttr attr;
+        if (!parseDeviceAttr(name, attr) || !normalizeAttrValue(attr, text, value)) {
+            return false;
+        }
+        Condition condition{attr, intern(value)};
+        bool duplicate = false;
+        for (const Condition& c : out) {
+            duplicate = duplicate || (c.attr == attr && c.value == condition.value);
+        }
+        if (!duplicate) {
+            out.push_back(condition);
+        }
+    }
+    return true;
+}
+
+// Builds the subtree for items and returns its node index. The node tests the
+// attribute most of the remaining items depend on; items that don't test it
+// go to the "rest" subtree, so no action is ever duplicated across branches.
+uint32_t RuleTableBuilder::buildCondTree(std::vector<CondItem>& items) {
+    RuleTable::Storage& storage = *m_table->m_storage;
+    uint32_t index = uint32_t(storage.condNodes.size());
+    storage.condNodes.push_back(RuleTable::CondNode{RuleTable::kNoAttr, 0, 0, 0, 0, 0});
+
+    std::vector<uint32_t> accepts;
+    size_t uses[kDeviceAttrCount] = {};
+    for (const CondItem& item : items) {
+        if (item.conditions.empty()) {
+            accepts.push_back(item.action);
+        }
+        for (const Condition& c : item.conditions) {
+            ++uses[size_t(c.attr)];
+        }
+    }
+    std::sort(accepts.begin(), accepts.end());
+    RuleTable::CondNode node{RuleTable::kNoAttr, 0, uint32_t(storage.condAccepts.size()), uint32_t(accepts.size()), 0, 0};
+    storage.condAccepts.insert(storage.condAccepts.end(), accepts.begin(), accepts.end());
+
+    size_t best = size_t(std::max_element(uses, uses + kDeviceAttrCount) - uses);
+    if (uses[best] == 0) {
+        storage.condNodes[index] = node;
+        return index;
+    }
+    DeviceAttr attr = DeviceAttr(best);
+    node.attr = uint32_t(attr);
+
+    // Split on attr; each item drops the first condition on it.
+    const char* pool = storage.strings.data();
+    std::map<std::string, std::vector<CondItem>> byValue;
+    std::vector<CondItem> rest;
+    for (CondItem& item : items) {
+        auto c = std::find_if(item.conditions.begin(), item.conditions.end(),
+                              [attr](const Condition& cond) { return cond.attr == attr; });
+        if (c == item.conditions.end()) {
+            if (!item.conditions.empty()) {
+                rest.push_back(std::move(item));
+            }
+            continue;
+        }
+        std::string value = pool + c->value;
+        item.conditions.erase(c);
+        byValue[value].push_back(std::move(item));
+    }
+
+    if (!rest.empty()) {
+        node.rest = buildCondTree(rest) + 1;
+    }
+    std::vector<RuleTable::CondEdge> edges;
+    for (auto& [value, children] : byValue) {
+        uint32_t child = buildCondTree(children);
+        edges.push_back(RuleTable::CondEdge{intern(value), child});
+    }
+    node.edge_begin = uint32_t(storage.condEdges.size());
+    node.edge_count = uint32_t(edges.size());
+    storage.condEdges.insert(storage.condEdges.end(), edges.begin(), edges.end());
+    storage.condNodes[index] = node;
+    return index;
+}
+
+// ports: (pending index, group index). Nodes are numbered breadth-first,
+// each node's edges are contiguous and sorted as matchPort() expects.
+void RuleTableBuilder::buildPortTrie(const std::vector<std::pair<size_t, uint32_t>>& ports) {
+    if (ports.empty()) {
+        return;
+    }
+    struct TempNode {
+        std::map<std::string, size_t> children;
+        uint32_t exact_group = 0;
+        uint32_t prefix_group = 0;
+    };
+    std::vector<TempNode> nodes(1);
+    for (const auto& [pendingIndex, groupIndex] : ports) {
+        const PendingGroup& pending = m_pending[pendingIndex];
+        size_t node = 0;
+        size_t begin = 0;
+        while (begin <= pending.port_path.size()) {
+            size_t end = pending.port_path.find('/', begin);
+            if (end == std::string::npos) {
+                end = pending.port_path.size();
+            }
+            std::string component = pending.port_path.substr(begin, end - begin);
+            auto child = nodes[node].children.find(component);
+            if (child == nodes[node].children.end()) {
+                child = nodes[node].children.emplace(component, nodes.size()).first;
+                nodes.emplace_back();
+            }
+            node = child->second;
+            begin = end + 1;
+        }
+        (pending.port_prefix ? nodes[node].prefix_group : nodes[node].exact_group) = groupIndex + 1;
+    }
+
+    RuleTable::Storage& storage = *m_table->m_storage;
+    std::vector<uint32_t> flatIndex(nodes.size());
+    std::vector<size_t> order(1, 0);
+    for (size_t i = 0; i < order.size(); ++i) {
+        flatIndex[order[i]] = uint32_t(i);
+        for (const auto& child : nodes[order[i]].children) {
+            order.push_back(child.second);
+        }
+    }
+    storage.portNodes.reserve(nodes.size());
+    for (size_t i = 0; i < order.size(); ++i) {
+        const TempNode& temp = nodes[order[i]];
+        RuleTable::PortNode node{uint32_t(storage.portEdges.size()), uint32_t(temp.children.size()),
+                                 temp.exact_group, temp.prefix_group};
+        for (const auto& [component, child] : temp.children) {
+            storage.portEdges.push_back(RuleTable::PortEdge{intern(component), flatIndex[child]});
+        }
+        storage.portNodes.push_back(node);
+    }
+}
+
+std::shared_ptr<const RuleTable> RuleTableBuilder::finish() {
+    RuleTable& table = *m_table;
+    RuleTable::Storage& storage = *table.m_storage;
+
+    size_t actionTotal = 0;
+    for (const PendingGroup& pending : m_pending) {
+        actionTotal += pending.actions.size();
+    }
+    storage.actions.reserve(actionTotal);
+    storage.groups.reserve(m_pending.size());
+
+    std::vector<std::pair<uint32_t, uint32_t>> exact;
+    std::vector<std::pair<uint32_t, uint32_t>> bucketByVid;
+    std::vector<std::vector<RuleTable::Interval>> bucketIntervals;
+    std::vector<std::vector<RuleTable::MaskEntry>> bucketMasks;
+    std::unordered_map<uint32_t, uint32_t> bucketIndex;
+    std::vector<std::pair<size_t, uint32_t>> ports;
+
+    for (size_t i = 0; i < m_pending.size(); ++i) {
+        const PendingGroup& pending = m_pending[i];
+        const UsbPattern& p = pending.pattern;
+        uint32_t groupIndex = uint32_t(storage.groups.size());
+
+        RuleTable::Group group;
+        group.pattern = intern(pending.text);
+        group.first_action = uint32_t(storage.actions.size());
+        group.action_count = uint32_t(pending.actions.size());
+        group.tree = 0;
+        group.priority = pending.is_port ? portPriority(pending.port_path, pending.port_prefix, i)
+                                         : patternPriority(p, i);
+        group.fingerprint = pending.fingerprint;
+        storage.fingerprints.push_back(pending.fingerprint);
+        storage.actions.insert(storage.actions.end(), pending.actions.begin(), pending.actions.end());
+        // Not needed past this point; keeps the peak of big configs down.
+        m_pending[i].actions = std::vector<CompiledAction>();
+        if (!pending.conditional.empty()) {
+            // Unconditional actions enter the tree as items with nothing left to test.
+            std::vector<CondItem> items;
+            items.reserve(group.action_count);
+            size_t next = 0;
+            for (uint32_t a = 0; a < group.action_count; ++a) {
+                if (next < pending.conditional.size() && pending.conditional[next].action == a) {
+                    items.push_back(std::move(m_pending[i].conditional[next++]));
+                } else {
+                    items.push_back(CondItem{a, {}});
+                }
+            }
+            group.tree = buildCondTree(items) + 1;
+        }
+        storage.groups.push_back(group);
+
+        if (pending.is_port) {
+            ports.emplace_back(i, groupIndex);
+            continue;
+        }
+        if (p.kind == UsbPattern::Exact) {
+            exact.emplace_back(makeUsbKey(p.vid, p.lo), groupIndex);
+            continue;
+        }
+
+        // The "*" VID bucket uses a key outside the 16-bit VID space.
+        uint32_t bucketKey = p.any_vid ? 0x10000u : p.vid;
+        auto bucket = bucketIndex.find(bucketKey);
+        if (bucket == bucketIndex.end()) {
+            bucket = bucketIndex.emplace(bucketKey, uint32_t(bucketIntervals.size())).first;
+            bucketIntervals.emplace_back();
+            bucketMasks.emplace_back();
+            if (p.any_vid) {
+                table.m_anyVidBucket = bucket->second;
+            } else {
+                bucketByVid.emplace_back(p.vid, bucket->second);
+            }
+        }
+        if (p.kind == UsbPattern::Range) {
+            bucketIntervals[bucket->second].push_back(RuleTable::Interval{p.lo, p.hi, 0, 0, groupIndex});
+        } else {
+            bucketMasks[bucket->second].push_back(RuleTable::MaskEntry{p.value, p.mask, groupIndex});
+        }
+    }
+
+    for (size_t b = 0; b < bucketIntervals.size(); ++b) {
+        std::vector<RuleTable::Interval>& intervals = bucketIntervals[b];
+        std::sort(intervals.begin(), intervals.end(),
+                  [](const RuleTable::Interval& x, const RuleTable::Interval& y) {
+                      return x.lo != y.lo ? x.lo < y.lo : (x.hi != y.hi ? x.hi < y.hi : x.group < y.group);
+                  });
+        buildIntervalTree(intervals.data(), 0, intervals.size());
+
+        RuleTable::Bucket bucket;
+        bucket.interval_begin = uint32_t(storage.intervals.size());
+        bucket.interval_count = uint32_t(intervals.size());
+        bucket.mask_begin = uint32_t(storage.masks.size());
+        bucket.mask_count = uint32_t(bucketMasks[b].size());
+        storage.intervals.insert(storage.intervals.end(), intervals.begin(), intervals.end());
+        storage.masks.insert(storage.masks.end(), bucketMasks[b].begin(), bucketMasks[b].end());
+        storage.buckets.push_back(bucket);
+    }
+
+    buildPortTrie(ports);
+    buildSlots(exact, storage.slots, table.m_slotShift, table.m_slotMask);
+    buildSlots(bucketByVid, storage.vidSlots, table.m_vidSlotShift, table.m_vidSlotMask);
+
+    std::sort(storage.fingerprints.begin(), storage.fingerprints.end());
+    storage.strings.shrink_to_fit();
+    storage.argIds.shrink_to_fit();
+    table.bindStorage();
+
+    m_internSlots = std::vector<uint32_t>();
+    m_internCount = 0;
+    m_groupByPattern.clear();
+    m_pending.clear();
+    return std::shared_ptr<const RuleTable>(m_table.release());
+}
@@ -0,0 +1,411 @@
+#ifndef RULETABLE_H
+#define RULETABLE_H
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "deviceattrs.h"
+#include "ruleconfig.h"
+#include "usbkey.h"
+
+// Compiled action. Strings are offsets into the table's interned string pool.
+struct CompiledAction {
+    enum : uint16_t { AuthRequired = 1, DropOverflow = 2 };
+
+    uint32_t script;
+    uint32_t args_begin;   // index into the argument id array
+    uint16_t args_count;
+    uint16_t flags;
+    int32_t delay_sec;
+    uint32_t max_concurrent;   // 0: no limit of its own
+};
+
+struct ActionRange {
+    const CompiledAction* first = nullptr;
+    const CompiledAction* last = nullptr;
+
+    const CompiledAction* begin() const { return first; }
+    const CompiledAction* end() const { return last; }
+    size_t size() const { return size_t(last - first); }
+    bool empty() const { return first == last; }
+};
+
+// One matched key pattern (group of actions) for a device.
+struct RuleMatch {
+    uint64_t priority;
+    uint32_t pattern;      // string id of the canonical key pattern
+    uint32_t tree;         // condition tree root + 1, 0 if no action has conditions
+    ActionRange actions;
+    uint64_t fingerprint;  // pattern and actions, see RuleTable::containsGroup
+};
+
+// Caller-owned result buffer: up to kCapacity matches are kept inline so
+// matching doesn't allocate; a device matching more spills to the heap.
+// Matches are kept in priority order: VID:PID patterns (fixed VID before "*",
+// then narrower PID sets before wider ones), then port patterns (deeper ports
+// first, exact before "*"), then config order.
+class RuleMatches {
+public:
+    static const size_t kCapacity = 64;
+
+    void clear() { m_size = 0; m_spill.clear(); }
+    void add(const RuleMatch& match) {
+        if (m_size == kCapacity && m_spill.empty()) {
+            m_spill.assign(m_items, m_items + kCapacity);
+        }
+        if (!m_spill.empty()) {
+            auto at = std::upper_bound(m_spill.begin(), m_spill.end(), match.priority,
+                                       [](uint64_t priority, const RuleMatch& m) { return priority < m.priority; });
+            m_spill.insert(at, match);
+            ++m_size;
+            return;
+        }
+        size_t i = m_size++;
+        while (i > 0 && m_items[i - 1].priority > match.priority) {
+            m_items[i] = m_items[i - 1];
+            --i;
+        }
+        m_items[i] = match;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    size_t actionCount() const {
+        size_t n = 0;
+        for (const RuleMatch& match : *this) n += match.actions.size();
+        return n;
+    }
+    const RuleMatch* begin() const { return m_spill.empty() ? m_items : m_spill.data(); }
+    const RuleMatch* end() const { return begin() + m_size; }
+
+private:
+    RuleMatch m_items[kCapacity];
+    size_t m_size = 0;
+    std::vector<RuleMatch> m_spill;     // all matches once there are more than kCapacity
+};
+
+// Actions of one RuleMatch whose conditions hold for the device, in config
+// order. Inline up to kCapacity, spilled to the heap beyond.
+class ActionSelection {
+public:
+    static const size_t kCapacity = 256;
+
+    void clear() { m_size = 0; m_spill.clear(); }
+    void add(const CompiledAction* action) {
+        if (m_size == kCapacity && m_spill.empty()) {
+            m_spill.assign(m_items, m_items + kCapacity);
+        }
+        if (!m_spill.empty()) {
+            m_spill.push_back(action);
+        } else {
+            m_items[m_size] = action;
+        }
+        ++m_size;
+    }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const CompiledAction* const* begin() const { return m_spill.empty() ? m_items : m_spill.data(); }
+    const CompiledAction* const* end() const { return begin() + m_size; }
+
+private:
+    friend class RuleTable;
+
+    const CompiledAction** data() { return m_spill.empty() ? m_items : m_spill.data(); }
+
+    const CompiledAction* m_items[kCapacity];
+    size_t m_size = 0;
+    std::vector<const CompiledAction*> m_spill;     // all actions once there are more than kCapacity
+};
+
+// Groups of two tables compared by fingerprint. A changed group counts as
+// removed and added.
+struct RuleDiff {
+    size_t kept = 0;
+    size_t added = 0;
+    size_t removed = 0;
+
+    bool empty() const { return added == 0 && removed == 0; }
+};
+
+struct RuleLoadInfo {
+    bool used_image = false;
+    std::string image_error;   // why an existing image was rejected
+};
+
+template <typename T>
+struct ArrayView {
+    const T* data = nullptr;
+    size_t size = 0;
+
+    const T& operator[](size_t i) const { return data[i]; }
+};
+
+// Immutable, compiled view of triggers.json. Built once per config change,
+// then only queried from the event path; lookups never allocate.
+//
+// Exact VID:PID keys live in a flat hash. Wildcard, range and mask keys are
+// indexed in two levels: a flat hash from VID to a bucket (plus one bucket for
+// "*" VIDs), and inside each bucket a static interval tree over PID ranges.
+// Masks that aren't plain ranges are scanned linearly within their bucket.
+//
+// "port:" keys live in a trie keyed on port path components ("usb1", "1-3",
+// "1-3.2"), children sorted by name, so a lookup costs O(depth * log fanout)
+// whatever the number of port rules.
+//
+// Actions with "match" conditions are compiled per key pattern into a
+// decision tree over device attributes. Each node accepts the actions whose
+// conditions are all satisfied on the path to it, then tests one attribute:
+// one edge per required value, plus a "rest" subtree for the remaining
+// actions that don't care about that attribute. An attribute is therefore
+// only read when some candidate still depends on it, and DeviceAttrs caches
+// it for the rest of the event.
+//
+// The arrays are either owned (compiled from JSON) or point straight into an
+// mmap'd rule image, see ruleimage.h.
+class RuleTable {
+public:
+    RuleTable();
+    ~RuleTable();
+
+    RuleTable(const RuleTable&) = delete;
+    RuleTable& operator=(const RuleTable&) = delete;
+
+    // Returns nullptr (and fills error) when the file can't be read or parsed.
+    static std::shared_ptr<const RuleTable> fromFile(const std::string& path, std::string* error = nullptr);
+    static std::shared_ptr<const RuleTable> fromConfig(const RuleConfig& config);
+
+    // Uses the precompiled image when it exists and matches configPath,
+    // otherwise compiles configPath.
+    static std::shared_ptr<const RuleTable> load(const std::string& configPath, const std::string& imagePath,
+                                                 std::string* error = nullptr, RuleLoadInfo* info = nullptr);
+
+    // Actions of the exact "vvvv:pppp" entry only.
+    ActionRange find(uint32_t key) const {
+        uint32_t group = probe(m_slots, m_slotShift, m_slotMask, key);
+        return group ? groupActions(m_groups[group - 1]) : ActionRange();
+    }
+
+    // All patterns matching key, in priority order. O(log n) per bucket.
+    void match(uint32_t key, RuleMatches& out) const;
+
+    // Same, plus the port patterns matching the device's sysfs devpath.
+    void match(uint32_t key, const char* devpath, RuleMatches& out) const;
+
+    // Actions of match whose conditions hold for the device.
+    void select(const RuleMatch& match, DeviceAttrs& attrs, ActionSelection& out) const;
+
+    // Whether a group with the same pattern and the same actions exists in
+    // this table. Work started from an older table checks this to find out
+    // whether its rule survived a reload.
+    bool containsGroup(uint64_t fingerprint) const;
+    static RuleDiff diff(const RuleTable& before, const RuleTable& after);
+
+    // The VID:PID pattern of every group, for filtering ahead of match().
+    // Returns false if there are port patterns, which any VID:PID can match.
+    bool usbPatterns(std::vector<UsbPattern>& out) const;
+
+    const char* string(uint32_t id) const { return m_strings.data + id; }
+    const char* script(const CompiledAction& action) const { return string(action.script); }
+    const char* arg(const CompiledAction& action, size_t i) const {
+        return string(m_argIds[action.args_begin + i]);
+    }
+
+    size_t keyCount() const { return m_groups.size; }
+    size_t actionCount() const { return m_actions.size; }
+    // Keys that aren't valid patterns plus actions with invalid conditions.
+    size_t invalidRuleCount() const { return m_invalidRules; }
+    size_t memoryUsage() const;
+    bool isMapped() const { return m_map != nullptr; }
+
+private:
+    friend class RuleTableBuilder;
+    friend class RuleImage;
+
+    static const uint32_t kNoBucket = 0xffffffffu;
+    static const uint32_t kNoAttr = 0xffffffffu;
+
+    struct Slot {
+        uint32_t key;
+        uint32_t value;   // index + 1, 0 marks an empty slot
+    };
+
+    struct Group {
+        uint32_t pattern;
+        uint32_t first_action;
+        uint32_t action_count;
+        uint32_t tree;      // condition tree root + 1, 0 if unconditional
+        uint64_t priority;
+        uint64_t fingerprint;
+    };
+
+    // Node of an implicit interval tree: intervals sorted by lo, the tree is
+    // the midpoint recursion over the array and max_hi covers the subtree.
+    struct Interval {
+        uint16_t lo;
+        uint16_t hi;
+        uint16_t max_hi;
+        uint16_t reserved;
+        uint32_t group;
+    };
+
+    struct MaskEntry {
+        uint16_t value;
+        uint16_t mask;
+        uint32_t group;
+    };
+
+    struct Bucket {
+        uint32_t interval_begin;
+        uint32_t interval_count;
+        uint32_t mask_begin;
+        uint32_t mask_count;
+    };
+
+    // Condition tree node. accepts are action offsets within the group; edges
+    // are sorted by value so the device value is found by binary search.
+    struct CondNode {
+        uint32_t attr;      // DeviceAttr tested, kNoAttr for a leaf
+        uint32_t rest;      // node + 1 for actions not testing attr, 0 if none
+        uint32_t accept_begin;
+        uint32_t accept_count;
+        uint32_t edge_begin;
+        uint32_t edge_count;
+    };
+
+    struct CondEdge {
+        uint32_t value;     // string id
+        uint32_t child;
+    };
+
+    // Port trie node; the root is node 0. Groups are index + 1, 0 for none.
+    struct PortNode {
+        uint32_t edge_begin;
+        uint32_t edge_count;
+        uint32_t exact_group;   // "port:usb1/1-3"
+        uint32_t prefix_group;  // "port:usb1/1-3*"
+    };
+
+    struct PortEdge {
+        uint32_t component;     // string id
+        uint32_t child;
+    };
+
+    struct MappedTag {};
+    explicit RuleTable(MappedTag);
+
+    struct Storage {
+        std::vector<char> strings;
+        std::vector<uint32_t> argIds;
+        std::vector<CompiledAction> actions;
+        std::vector<Group> groups;
+        std::vector<Slot> slots;
+        std::vector<Slot> vidSlots;
+        std::vector<Bucket> buckets;
+        std::vector<Interval> intervals;
+        std::vector<MaskEntry> masks;
+        std::vector<CondNode> condNodes;
+        std::vector<CondEdge> condEdges;
+        std::vector<uint32_t> condAccepts;
+        std::vector<PortNode> portNodes;
+        std::vector<PortEdge> portEdges;
+        std::vector<uint64_t> fingerprints;     // of all groups, sorted
+    };
+
+    static uint32_t probe(const ArrayView<Slot>& slots, uint32_t shift, uint32_t mask, uint32_t key) {
+        uint32_t slot = (key * 0x9e3779b1u) >> shift;
+        for (;;) {
+            const Slot& s = slots[slot];
+            if (s.value == 0 || s.key == key) {
+                return s.value;
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    ActionRange groupActions(const Group& g) const {
+        return ActionRange{m_actions.data + g.first_action, m_actions.data + g.first_action + g.action_count};
+    }
+
+    void addMatch(uint32_t group, RuleMatches& out) const;
+    void matchBucket(const Bucket& bucket, uint16_t pid, RuleMatches& out) const;
+    void matchPort(const char* devpath, RuleMatches& out) const;
+    void selectNode(uint32_t node, const CompiledAction* actions, DeviceAttrs& attrs, ActionSelection& out) const;
+    void bindStorage();
+
+    ArrayView<char> m_strings;
+    ArrayView<uint32_t> m_argIds;
+    ArrayView<CompiledAction> m_actions;
+    ArrayView<Group> m_groups;
+    ArrayView<Slot> m_slots;
+    ArrayView<Slot> m_vidSlots;
+    ArrayView<Bucket> m_buckets;
+    ArrayView<Interval> m_intervals;
+    ArrayView<MaskEntry> m_masks;
+    ArrayView<CondNode> m_condNodes;
+    ArrayView<CondEdge> m_condEdges;
+    ArrayView<uint32_t> m_condAccepts;
+    ArrayView<PortNode> m_portNodes;
+    ArrayView<PortEdge> m_portEdges;
+    ArrayView<uint64_t> m_fingerprints;
+    uint32_t m_slotMask;
+    uint32_t m_slotShift;
+    uint32_t m_vidSlotMask;
+    uint32_t m_vidSlotShift;
+    uint32_t m_anyVidBucket = kNoBucket;
+    size_t m_invalidRules = 0;
+
+    std::unique_ptr<Storage> m_storage;
+    void* m_map = nullptr;
+    size_t m_mapSize = 0;
+};
+
+// Accumulates key patterns and interns strings, then emits a RuleTable.
+class RuleTableBuilder {
+public:
+    RuleTableBuilder();
+
+    // Returns false if the key is not a valid VID:PID or "port:" pattern. Actions with unknown
+    // attributes or malformed values in "match" are skipped.
+    bool addGroup(const std::string& pattern, const std::vector<ActionSpec>& actions);
+    std::shared_ptr<const RuleTable> finish();
+
+private:
+    struct Condition {
+        DeviceAttr attr;
+        uint32_t value;     // string id
+    };
+
+    struct CondItem {
+        uint32_t action;    // offset within the group
+        std::vector<Condition> conditions;
+    };
+
+    struct PendingGroup {
+        std::string text;
+        bool is_port;
+        UsbPattern pattern;
+        std::string port_path;
+        bool port_prefix;
+        uint64_t fingerprint;
+        std::vector<CompiledAction> actions;
+        std::vector<CondItem> conditional;
+    };
+
+    uint32_t intern(const std::string& str);
+    bool compileConditions(const ActionSpec& spec, std::vector<Condition>& out);
+    uint32_t buildCondTree(std::vector<CondItem>& items);
+    void buildPortTrie(const std::vector<std::pair<size_t, uint32_t>>& ports);
+
+    std::unique_ptr<RuleTable> m_table;
+    std::vector<uint32_t> m_internSlots;    // pool offset + 1, 0 marks an empty slot
+    size_t m_internCount = 0;
+    std::unordered_map<std::string, size_t> m_groupByPattern;
+    std::vector<PendingGroup> m_pending;
+};
+
+#endif // RULETABLE_H
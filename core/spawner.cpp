@@ -0,0 +1,248 @@
+#include "spawner.h"
+#include <cerrno>
+#include <csignal>
+#include <cstring>
+#include <deque>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/prctl.h>
+#include <sys/signalfd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <unordered_map>
+
+namespace {
+
+struct RequestHeader {
+    uint64_t tag;
+    uint32_t flags;
+    uint32_t argc;
+};
+
+// The helper never blocks on a send: a parent that spawns many scripts
+// before reading would stop reading requests too. Events wait here until
+// the socket has room.
+class Outbox {
+public:
+    explicit Outbox(int fd) : m_fd(fd) {}
+
+    void send(Spawner::Event::Type type, int32_t value, uint64_t tag) {
+        m_events.push_back({type, value, tag});
+        flush();
+    }
+    void flush() {
+        while (!m_events.empty()) {
+            ssize_t sent = ::send(m_fd, &m_events.front(), sizeof(Spawner::Event), MSG_NOSIGNAL | MSG_DONTWAIT);
+            if (sent < 0 && errno == EINTR) {
+                continue;
+            }
+            if (sent < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+                return;
+            }
+            if (sent < 0) {
+                _exit(0);
+            }
+            m_events.pop_front();
+        }
+    }
+    bool pending() const { return !m_events.empty(); }
+
+private:
+    int m_fd;
+    std::deque<Spawner::Event> m_events;
+};
+
+// Starts one request's script and remembers it by pid.
+void startScript(Outbox& out, const char* message, size_t size, std::unordered_map<pid_t, uint64_t>& running,
+                 std::vector<const char*>& argv) {
+    RequestHeader header;
+    if (size < sizeof(header)) {
+        return;
+    }
+    memcpy(&header, message, sizeof(header));
+    argv.clear();
+    const char* p = message + sizeof(header);
+    const char* end = message + size;
+    for (uint32_t i = 0; i < header.argc && p < end; ++i) {
+        const char* nul = static_cast<const char*>(memchr(p, '\0', size_t(end - p)));
+        if (!nul) {
+            break;
+        }
+        argv.push_back(p);
+        p = nul + 1;
+    }
+    if (argv.empty() || argv.size() != header.argc) {
+        out.send(Spawner::Event::Failed, EINVAL, header.tag);
+        return;
+    }
+    argv.push_back(nullptr);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execAction(argv.data(), header.flags & Spawner::NewSession);
+    }
+    if (pid < 0) {
+        out.send(Spawner::Event::Failed, errno, header.tag);
+        return;
+    }
+    running.emplace(pid, header.tag);
+    out.send(Spawner::Event::Started, pid, header.tag);
+}
+
+// The helper's loop, until the other end closes the socket.
+[[noreturn]] void serve(int fd) {
+    prctl(PR_SET_NAME, "autotriggers-sp", 0, 0, 0);
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    sigprocmask(SIG_BLOCK, &mask, nullptr);
+    int signals = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (signals < 0) {
+        _exit(1);
+    }
+
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+
+    Outbox out(fd);
+    std::unordered_map<pid_t, uint64_t> running;
+    std::vector<char> message(Spawner::kMaxMessage);
+    std::vector<const char*> argv;
+    struct pollfd fds[2] = {{fd, POLLIN, 0}, {signals, POLLIN, 0}};
+    for (;;) {
+        fds[0].events = out.pending() ? POLLIN | POLLOUT : POLLIN;
+        if (poll(fds, 2, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            _exit(1);
+        }
+        if (fds[1].revents) {
+            struct signalfd_siginfo info;
+            while (read(signals, &info, sizeof(info)) > 0) {
+            }
+            int status;
+            pid_t pid;
+            while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+                auto it = running.find(pid);
+                if (it != running.end()) {
+                    out.send(Spawner::Event::Exited, status, it->second);
+                    running.erase(it);
+                }
+            }
+        }
+        if (fds[0].revents & POLLOUT) {
+            out.flush();
+        }
+        if (fds[0].revents & ~POLLOUT) {
+            ssize_t size = recv(fd, message.data(), message.size(), 0);
+            if (size < 0 && (errno == EINTR || errno == EAGAIN)) {
+                continue;
+            }
+            if (size <= 0) {
+                _exit(0);
+            }
+            startScript(out, message.data(), size_t(size), running, argv);
+        }
+    }
+}
+
+} // namespace
+
+// Only async-signal-safe calls between fork and exec. The script starts
+// with no blocked signals whatever the daemon blocks for its signalfd.
+void execAction(const char* const* argv, bool newSession) {
+    if (newSession) {
+        setsid();
+    }
+    sigset_t none;
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, nullptr);
+    int devnull = open("/dev/null", O_RDWR);
+    if (devnull != -1) {
+        dup2(devnull, STDIN_FILENO);
+        dup2(devnull, STDOUT_FILENO);
+        dup2(devnull, STDERR_FILENO);
+        if (devnull > STDERR_FILENO) {
+            close(devnull);
+        }
+    }
+    execvp(argv[0], const_cast<char* const*>(argv));
+    _exit(127);
+}
+
+std::unique_ptr<Spawner> Spawner::start(std::string* error) {
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET | SOCK_CLOEXEC, 0, fds) != 0) {
+        if (error) {
+            *error = std::string("socketpair: ") + strerror(errno);
+        }
+        return nullptr;
+    }
+    pid_t pid = fork();
+    if (pid < 0) {
+        if (error) {
+            *error = std::string("fork: ") + strerror(errno);
+        }
+        close(fds[0]);
+        close(fds[1]);
+        return nullptr;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        serve(fds[1]);
+    }
+    close(fds[1]);
+    return std::unique_ptr<Spawner>(new Spawner(fds[0], pid));
+}
+
+Spawner::Spawner(int fd, pid_t pid)
+    : m_fd(fd),
+      m_pid(pid) {
+}
+
+Spawner::~Spawner() {
+    close(m_fd);
+    while (waitpid(m_pid, nullptr, 0) < 0 && errno == EINTR) {
+    }
+}
+
+bool Spawner::spawn(uint64_t tag, const char* const* argv, uint32_t flags) {
+    if (!m_alive) {
+        return false;
+    }
+    RequestHeader header{tag, flags, 0};
+    m_request.resize(sizeof(header));
+    for (; argv[header.argc]; ++header.argc) {
+        const char* arg = argv[header.argc];
+        m_request.insert(m_request.end(), arg, arg + strlen(arg) + 1);
+        if (m_request.size() > kMaxMessage) {
+            return false;
+        }
+    }
+    memcpy(m_request.data(), &header, sizeof(header));
+    ssize_t sent;
+    while ((sent = send(m_fd, m_request.data(), m_request.size(), MSG_NOSIGNAL)) < 0 && errno == EINTR) {
+    }
+    if (sent < 0) {
+        m_alive = false;
+        return false;
+    }
+    return true;
+}
+
+bool Spawner::receive(Event& event, bool block) {
+    if (!m_alive) {
+        return false;
+    }
+    ssize_t size;
+    while ((size = recv(m_fd, &event, sizeof(event), block ? 0 : MSG_DONTWAIT)) < 0 && errno == EINTR) {
+    }
+    if (size < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        return false;
+    }
+    if (size != ssize_t(sizeof(event))) {
+        m_alive = false;
+        return false;
+    }
+    return true;
+}
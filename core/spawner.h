@@ -0,0 +1,69 @@
+#ifndef SPAWNER_H
+#define SPAWNER_H
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+
+// Pre-forked helper that starts action scripts for a large process. fork()
+// copies the caller's page tables, which in a Qt GUI with a big RSS costs
+// far more than starting the script; the helper is forked at startup,
+// before the GUI grows, and forks from its small address space instead.
+//
+// Requests and replies travel over a SOCK_SEQPACKET socketpair, one
+// message each: the helper reports the pid of every script it started
+// and, once the script exits, its wait status. The helper queues replies
+// the socket has no room for, so any number of requests may be sent
+// before the first receive(). Scripts inherit the helper's environment
+// and working directory. The helper exits when its socket is closed;
+// scripts still running are left to run.
+class Spawner {
+public:
+    enum : uint32_t { NewSession = 1 };     // setsid() in the script
+
+    struct Event {
+        enum Type : uint32_t { Started, Failed, Exited };
+        Type type;
+        int32_t value;      // pid, errno or wait status
+        uint64_t tag;       // as passed to spawn()
+    };
+
+    // Largest request: the argv strings and a small header.
+    static const size_t kMaxMessage = 64 * 1024;
+
+    // Forks the helper. Call early in main(), while the process has a
+    // single thread.
+    static std::unique_ptr<Spawner> start(std::string* error = nullptr);
+    // Closes the socket and reaps the helper.
+    ~Spawner();
+
+    Spawner(const Spawner&) = delete;
+    Spawner& operator=(const Spawner&) = delete;
+
+    // Readable when events are pending.
+    int fd() const { return m_fd; }
+    bool isAlive() const { return m_alive; }
+
+    // Sends a start request; Started or Failed with the same tag follows.
+    // False if argv doesn't fit one message or the helper is gone.
+    bool spawn(uint64_t tag, const char* const* argv, uint32_t flags);
+    // Takes the next event. False if there is none yet (without block) or
+    // the helper is gone, which isAlive() then tells.
+    bool receive(Event& event, bool block);
+
+private:
+    Spawner(int fd, pid_t pid);
+
+    int m_fd;
+    pid_t m_pid;
+    bool m_alive = true;
+    std::vector<char> m_request;
+};
+
+// The child's side of starting a script: no blocked signals, stdio on
+// /dev/null, optionally a new session, then exec. Async-signal-safe.
+[[noreturn]] void execAction(const char* const* argv, bool newSession);
+
+#endif // SPAWNER_H
@@ -0,0 +1,114 @@
+#include "supervisor.h"
+#include <cerrno>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+#include <vector>
+#include "reactor.h"
+
+namespace {
+
+// pidfds are always close-on-exec.
+int openPidfd(pid_t pid) {
+#ifdef SYS_pidfd_open
+    return int(syscall(SYS_pidfd_open, pid, 0));
+#else
+    (void)pid;
+    errno = ENOSYS;
+    return -1;
+#endif
+}
+
+} // namespace
+
+ProcessSupervisor::~ProcessSupervisor() {
+    detach();
+}
+
+bool ProcessSupervisor::isSupported() {
+    static const bool supported = [] {
+        int pidfd = openPidfd(getpid());
+        if (pidfd < 0) {
+            return false;
+        }
+        close(pidfd);
+        return true;
+    }();
+    return supported;
+}
+
+void ProcessSupervisor::attach(Reactor& reactor) {
+    if (m_reactor == &reactor) {
+        return;
+    }
+    for (const auto& child : m_children) {
+        int pidfd = child.first;
+        if (m_reactor) {
+            m_reactor->remove(pidfd);
+        }
+        reactor.add(pidfd, EPOLLIN, [this, pidfd](uint32_t) { reap(pidfd, false); });
+    }
+    m_reactor = &reactor;
+}
+
+void ProcessSupervisor::detach() {
+    std::vector<int> pidfds;
+    for (const auto& child : m_children) {
+        pidfds.push_back(child.first);
+    }
+    for (int pidfd : pidfds) {
+        reap(pidfd, true);
+    }
+    m_reactor = nullptr;
+}
+
+void ProcessSupervisor::abandon() {
+    for (const auto& child : m_children) {
+        if (m_reactor) {
+            m_reactor->remove(child.first);
+        }
+        close(child.first);
+    }
+    m_children.clear();
+}
+
+bool ProcessSupervisor::watch(pid_t pid, ExitHandler onExit) {
+    if (!m_reactor) {
+        return false;
+    }
+    int pidfd = openPidfd(pid);
+    if (pidfd < 0) {
+        return false;
+    }
+    if (!m_reactor->add(pidfd, EPOLLIN, [this, pidfd](uint32_t) { reap(pidfd, false); })) {
+        close(pidfd);
+        return false;
+    }
+    m_children.emplace(pidfd, Child{pid, std::chrono::steady_clock::now(), std::move(onExit)});
+    return true;
+}
+
+void ProcessSupervisor::reap(int pidfd, bool block) {
+    auto it = m_children.find(pidfd);
+    if (it == m_children.end()) {
+        return;
+    }
+    int status = 0;
+    pid_t reaped;
+    while ((reaped = waitpid(it->second.pid, &status, block ? 0 : WNOHANG)) < 0 && errno == EINTR) {
+    }
+    if (reaped == 0) {
+        return;
+    }
+    Child child = std::move(it->second);
+    m_children.erase(it);
+    if (m_reactor) {
+        m_reactor->remove(pidfd);
+    }
+    close(pidfd);
+    auto duration = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now()
+                                                                          - child.started);
+    child.onExit(reaped < 0 ? -1 : status, duration);
+}
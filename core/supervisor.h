@@ -0,0 +1,59 @@
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <chrono>
+#include <cstddef>
+#include <functional>
+#include <sys/types.h>
+#include <unordered_map>
+
+class Reactor;
+
+// Reaps child processes from an event loop: each child's pidfd is added to
+// the reactor and its exit status is collected when it becomes readable,
+// so any number of children run while the loop keeps handling events.
+// Used from the loop's thread only.
+class ProcessSupervisor {
+public:
+    // The child's wait status (-1 if it couldn't be collected) and how long
+    // it ran.
+    using ExitHandler = std::function<void(int status, std::chrono::milliseconds duration)>;
+
+    ProcessSupervisor() = default;
+    ~ProcessSupervisor();
+
+    ProcessSupervisor(const ProcessSupervisor&) = delete;
+    ProcessSupervisor& operator=(const ProcessSupervisor&) = delete;
+
+    // Children already watched have their pidfds moved over from the
+    // previous reactor; neither loop may be running meanwhile.
+    void attach(Reactor& reactor);
+    // Waits for the children still running and reports them.
+    void detach();
+    // Stops watching the children without waiting; they are not reported.
+    void abandon();
+    bool isAttached() const { return m_reactor != nullptr; }
+
+    // Takes over a forked child. False without a reactor or pidfd support
+    // (Linux < 5.3); the caller then waits for it itself.
+    bool watch(pid_t pid, ExitHandler onExit);
+
+    size_t runningCount() const { return m_children.size(); }
+
+    // Whether this kernel has pidfd_open().
+    static bool isSupported();
+
+private:
+    struct Child {
+        pid_t pid;
+        std::chrono::steady_clock::time_point started;
+        ExitHandler onExit;
+    };
+
+    void reap(int pidfd, bool block);
+
+    Reactor* m_reactor = nullptr;
+    std::unordered_map<int, Child> m_children;    // by pidfd
+};
+
+#endif // SUPERVISOR_H
@@ -0,0 +1,122 @@
+#include "sysfsscan.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <thread>
+#include <unistd.h>
+
+namespace {
+
+// Entry names of a directory, "." and ".." excluded.
+bool readNames(int dirfd, std::vector<std::string>& out) {
+    alignas(struct dirent64) char buf[32768];
+    for (;;) {
+        ssize_t n = getdents64(dirfd, buf, sizeof(buf));
+        if (n < 0) {
+            return false;
+        }
+        if (n == 0) {
+            return true;
+        }
+        for (ssize_t pos = 0; pos < n;) {
+            const struct dirent64* entry = reinterpret_cast<const struct dirent64*>(buf + pos);
+            if (entry->d_name[0] != '.') {
+                out.push_back(entry->d_name);
+            }
+            pos += entry->d_reclen;
+        }
+    }
+}
+
+// The kernel message the device would send on "add": header, ACTION,
+// DEVPATH and SUBSYSTEM, then the KEY=value lines of its uevent file.
+bool readDevice(int busfd, const std::string& name, std::string& out) {
+    char link[PATH_MAX];
+    ssize_t len = readlinkat(busfd, name.c_str(), link, sizeof(link) - 1);
+    if (len <= 0) {
+        return false;
+    }
+    link[len] = '\0';
+    const char* devpath = link;
+    while (strncmp(devpath, "../", 3) == 0) {
+        devpath += 3;
+    }
+
+    int fd = openat(busfd, (name + "/uevent").c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    char uevent[4096];
+    ssize_t size = read(fd, uevent, sizeof(uevent));
+    close(fd);
+    if (size < 0) {
+        return false;
+    }
+
+    out.reserve(3 * strlen(devpath) + size_t(size) + 48);
+    out.append("add@/").append(devpath).push_back('\0');
+    out.append("ACTION=add").push_back('\0');
+    out.append("DEVPATH=/").append(devpath).push_back('\0');
+    out.append("SUBSYSTEM=usb").push_back('\0');
+    out.append(uevent, size_t(size));
+    std::replace(out.end() - size, out.end(), '\n', '\0');
+    return true;
+}
+
+} // namespace
+
+bool SysfsUsbScan::run(unsigned threads, std::string* error) {
+    m_messages.clear();
+    m_events.clear();
+
+    std::string busPath = m_root + "/bus/usb/devices";
+    int busfd = open(busPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (busfd < 0) {
+        if (error) *error = busPath + ": " + strerror(errno);
+        return false;
+    }
+    std::vector<std::string> names;
+    if (!readNames(busfd, names)) {
+        if (error) *error = busPath + ": " + strerror(errno);
+        close(busfd);
+        return false;
+    }
+    // Interfaces are "<port>:<config>.<n>"; devices have no colon.
+    names.erase(std::remove_if(names.begin(), names.end(),
+                               [](const std::string& name) { return name.find(':') != std::string::npos; }),
+                names.end());
+
+    m_messages.resize(names.size());
+    std::atomic<size_t> next(0);
+    auto worker = [&] {
+        for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < names.size();) {
+            if (!readDevice(busfd, names[i], m_messages[i])) {
+                m_messages[i].clear();
+            }
+        }
+    };
+    // A thread per few dozen devices at most; small trees stay on this one.
+    size_t count = std::min<size_t>(std::max(threads, 1u), names.size() / 32 + 1);
+    std::vector<std::thread> pool;
+    for (size_t i = 1; i < count; ++i) {
+        pool.emplace_back(worker);
+    }
+    worker();
+    for (std::thread& thread : pool) {
+        thread.join();
+    }
+    close(busfd);
+
+    m_events.reserve(m_messages.size());
+    for (const std::string& message : m_messages) {
+        Uevent event;
+        if (!message.empty() && event.parse(message.data(), message.size()) && event.isUsbDevice()) {
+            m_events.push_back(event);
+        }
+    }
+    return true;
+}
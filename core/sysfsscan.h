@@ -0,0 +1,37 @@
+#ifndef SYSFSSCAN_H
+#define SYSFSSCAN_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include "uevent.h"
+
+// Lists the plugged-in USB devices straight from sysfs, for hosts with
+// thousands of them where libudev enumeration (a udev_device and a udev
+// database lookup per entry) takes seconds. /sys/bus/usb/devices is read
+// with getdents64, each device costs one readlinkat plus one openat/read
+// of its "uevent" file, and the devices are split over a few threads.
+//
+// Every device becomes a synthetic "add" Uevent, so it goes through the
+// same matching as events from the kernel source.
+class SysfsUsbScan {
+public:
+    static const unsigned kDefaultThreads = 4;
+
+    explicit SysfsUsbScan(std::string root = "/sys") : m_root(std::move(root)) {}
+
+    // Returns false if the bus directory can't be read. Devices that vanish
+    // meanwhile are skipped.
+    bool run(unsigned threads = kDefaultThreads, std::string* error = nullptr);
+
+    // usb_device entries only, in directory order. Valid while the scan lives.
+    size_t size() const { return m_events.size(); }
+    const Uevent& operator[](size_t i) const { return m_events[i]; }
+
+private:
+    std::string m_root;
+    std::vector<std::string> m_messages;
+    std::vector<Uevent> m_events;
+};
+
+#endif // SYSFSSCAN_H
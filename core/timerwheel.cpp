@@ -0,0 +1,163 @@
+#include "timerwheel.h"
+#include <algorithm>
+
+TimerWheel::TimerWheel(uint64_t now)
+    : m_now(now), m_heads(kOverflow + 1, kNil), m_tails(kOverflow + 1, kNil) {
+}
+
+TimerWheel::Id TimerWheel::schedule(uint64_t due) {
+    uint32_t index;
+    if (m_free != kNil) {
+        index = m_free;
+        m_free = m_nodes[index].next;
+    } else {
+        index = uint32_t(m_nodes.size());
+        m_nodes.push_back(Node{0, 0, kNil, kNil, 0, kFree});
+    }
+    Node& node = m_nodes[index];
+    node.due = due;
+    node.order = m_nextOrder++;
+    place(index);
+    ++m_size;
+    return (uint64_t(node.generation) << 32) | (uint64_t(index) + 1);
+}
+
+bool TimerWheel::cancel(Id id) {
+    uint64_t slot = id & 0xffffffffu;
+    if (slot == 0 || slot > m_nodes.size()) {
+        return false;
+    }
+    uint32_t index = uint32_t(slot - 1);
+    if (m_nodes[index].list == kFree || m_nodes[index].generation != uint32_t(id >> 32)) {
+        return false;
+    }
+    unlink(index);
+    release(index);
+    --m_size;
+    return true;
+}
+
+// The level is that of the highest bit group in which due differs from the
+// current tick; past deadlines go to the current tick.
+void TimerWheel::place(uint32_t index) {
+    uint64_t due = std::max(m_nodes[index].due, m_now);
+    uint64_t diff = due ^ m_now;
+    unsigned level = diff ? unsigned(63 - __builtin_clzll(diff)) / kSlotBits : 0;
+    if (level >= kLevels) {
+        link(index, kOverflow);
+        return;
+    }
+    link(index, uint16_t(level * kSlots + ((due >> (level * kSlotBits)) & (kSlots - 1))));
+}
+
+void TimerWheel::link(uint32_t index, uint16_t list) {
+    Node& node = m_nodes[index];
+    node.list = list;
+    node.next = kNil;
+    node.prev = m_tails[list];
+    if (node.prev != kNil) {
+        m_nodes[node.prev].next = index;
+    } else {
+        m_heads[list] = index;
+    }
+    m_tails[list] = index;
+    if (list < kOverflow) {
+        m_occupied[list / kSlots] |= uint64_t(1) << (list % kSlots);
+    }
+}
+
+void TimerWheel::unlink(uint32_t index) {
+    Node& node = m_nodes[index];
+    uint16_t list = node.list;
+    if (node.prev != kNil) {
+        m_nodes[node.prev].next = node.next;
+    } else {
+        m_heads[list] = node.next;
+    }
+    if (node.next != kNil) {
+        m_nodes[node.next].prev = node.prev;
+    } else {
+        m_tails[list] = node.prev;
+    }
+    if (list < kOverflow && m_heads[list] == kNil) {
+        m_occupied[list / kSlots] &= ~(uint64_t(1) << (list % kSlots));
+    }
+}
+
+void TimerWheel::release(uint32_t index) {
+    Node& node = m_nodes[index];
+    node.list = kFree;
+    ++node.generation;
+    node.next = m_free;
+    m_free = index;
+}
+
+// Slots below the current one are empty: time never moves past an occupied
+// slot's start. On a tie the higher level wins, so a cascade lands before
+// the expiry it may add to.
+bool TimerWheel::earliest(unsigned& level, unsigned& slot, uint64_t& start) const {
+    bool found = false;
+    if (m_heads[kOverflow] != kNil) {
+        const unsigned bits = kLevels * kSlotBits;
+        level = kLevels;
+        slot = 0;
+        start = ((m_now >> bits) + 1) << bits;
+        found = true;
+    }
+    for (unsigned l = kLevels; l-- > 0;) {
+        unsigned shift = l * kSlotBits;
+        unsigned current = unsigned(m_now >> shift) & (kSlots - 1);
+        uint64_t bits = m_occupied[l] & (~uint64_t(0) << current);
+        if (!bits) {
+            continue;
+        }
+        unsigned s = unsigned(__builtin_ctzll(bits));
+        uint64_t at = std::max(m_now, ((m_now >> (shift + kSlotBits)) << (shift + kSlotBits)) | (uint64_t(s) << shift));
+        if (!found || at < start) {
+            level = l;
+            slot = s;
+            start = at;
+            found = true;
+        }
+    }
+    return found;
+}
+
+void TimerWheel::advance(uint64_t now, std::vector<Id>& out) {
+    std::vector<uint32_t> batch;
+    unsigned level, slot;
+    uint64_t start;
+    while (earliest(level, slot, start) && start <= now) {
+        m_now = start;
+        uint16_t list = level == kLevels ? kOverflow : uint16_t(level * kSlots + slot);
+        batch.clear();
+        for (uint32_t index = m_heads[list]; index != kNil; index = m_nodes[index].next) {
+            batch.push_back(index);
+        }
+        m_heads[list] = m_tails[list] = kNil;
+        if (list < kOverflow) {
+            m_occupied[level] &= ~(uint64_t(1) << slot);
+        }
+        if (level > 0) {
+            for (uint32_t index : batch) {
+                place(index);
+            }
+            continue;
+        }
+        // Cascades append, so order within the tick is restored here.
+        std::sort(batch.begin(), batch.end(),
+                  [this](uint32_t a, uint32_t b) { return m_nodes[a].order < m_nodes[b].order; });
+        for (uint32_t index : batch) {
+            out.push_back((uint64_t(m_nodes[index].generation) << 32) | (uint64_t(index) + 1));
+            release(index);
+            --m_size;
+        }
+        m_now = start + 1;
+    }
+    m_now = std::max(m_now, now + 1);
+}
+
+bool TimerWheel::nextWakeup(uint64_t& when) const {
+    unsigned level, slot;
+    return earliest(level, slot, when);
+}
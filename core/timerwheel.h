@@ -0,0 +1,69 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Hierarchical timer wheel with millisecond ticks: kLevels levels of 64
+// slots, level L holding timers whose due time first differs from the
+// current tick in bits [6L, 6L+6). Scheduling and cancelling are O(1);
+// advance() cascades a slot into the levels below only when time reaches
+// it. Timers due at the same tick share a slot and expire together.
+//
+// Times are absolute milliseconds on any monotonic clock. Not thread-safe.
+class TimerWheel {
+public:
+    using Id = uint64_t;
+    static constexpr Id kInvalid = 0;
+
+    explicit TimerWheel(uint64_t now);
+
+    Id schedule(uint64_t due);
+    bool cancel(Id id);
+
+    // Moves time forward to now and appends the expired timers to out, in
+    // due order (ties in scheduling order).
+    void advance(uint64_t now, std::vector<Id>& out);
+
+    // When advance() has something to do next: an expiry, or a cascade that
+    // may precede one. False if no timer is pending.
+    bool nextWakeup(uint64_t& when) const;
+
+    size_t size() const { return m_size; }
+
+private:
+    static constexpr unsigned kSlotBits = 6;
+    static constexpr unsigned kSlots = 1u << kSlotBits;
+    static constexpr unsigned kLevels = 6;
+    static constexpr uint32_t kNil = 0xffffffffu;
+
+    struct Node {
+        uint64_t due;
+        uint64_t order;     // scheduling order, for ties
+        uint32_t prev;
+        uint32_t next;
+        uint32_t generation;
+        uint16_t list;      // level * kSlots + slot, kOverflow, or kFree
+    };
+    static constexpr uint16_t kOverflow = kLevels * kSlots;
+    static constexpr uint16_t kFree = kOverflow + 1;
+
+    void place(uint32_t index);
+    void link(uint32_t index, uint16_t list);
+    void unlink(uint32_t index);
+    void release(uint32_t index);
+    // Level and slot holding the earliest slot start, and that start.
+    bool earliest(unsigned& level, unsigned& slot, uint64_t& start) const;
+
+    uint64_t m_now;                 // every tick before this is processed
+    std::vector<Node> m_nodes;
+    uint64_t m_nextOrder = 0;
+    uint32_t m_free = kNil;
+    std::vector<uint32_t> m_heads;  // per list; kOverflow is the last
+    std::vector<uint32_t> m_tails;
+    uint64_t m_occupied[kLevels] = {};
+    size_t m_size = 0;
+};
+
+#endif // TIMERWHEEL_H
@@ -0,0 +1,73 @@
+#ifndef UDEVATTRS_H
+#define UDEVATTRS_H
+
+#include <libudev.h>
+#include <string>
+#include "deviceattrs.h"
+#include "uevent.h"
+
+// DeviceAttrs backed by a udev_device. Returned strings are owned by the
+// device (or this object) and stay valid until it is unref'd.
+//
+// busnum and the class come from the kernel's BUSNUM=/TYPE= properties the
+// event already carries, with sysfs as the fallback. Strings tested by
+// conditions are always read from sysfs: udev's ID_* copies are mangled
+// (spaces replaced, fallbacks filled in). Display names come from the
+// escaped ID_VENDOR_ENC/ID_MODEL_ENC properties, which are exact enough for
+// a log line.
+class UdevDeviceAttrs : public DeviceAttrs {
+public:
+    explicit UdevDeviceAttrs(struct udev_device* dev) : m_dev(dev) {}
+
+    std::string displayName() override {
+        const char* vendor = udev_device_get_property_value(m_dev, "ID_VENDOR_ENC");
+        const char* model = udev_device_get_property_value(m_dev, "ID_MODEL_ENC");
+        if (vendor && model) {
+            return decode(vendor) + " " + decode(model);
+        }
+        return DeviceAttrs::displayName();
+    }
+
+protected:
+    const char* fetch(DeviceAttr attr) override {
+        switch (attr) {
+        case DeviceAttr::BusNum:
+            return property("BUSNUM", ueventBusNum, m_busnum) ? m_busnum.c_str()
+                                                              : udev_device_get_sysattr_value(m_dev, "busnum");
+        case DeviceAttr::DeviceClass:
+            return property("TYPE", ueventDeviceClass, m_class) ? m_class.c_str()
+                                                                : udev_device_get_sysattr_value(m_dev, "bDeviceClass");
+        case DeviceAttr::InterfaceClass: return udev_device_get_property_value(m_dev, "ID_USB_INTERFACES");
+        case DeviceAttr::Manufacturer:   return udev_device_get_sysattr_value(m_dev, "manufacturer");
+        case DeviceAttr::Product:        return udev_device_get_sysattr_value(m_dev, "product");
+        case DeviceAttr::Serial:         return udev_device_get_sysattr_value(m_dev, "serial");
+        default:                         return nullptr;
+        }
+    }
+
+private:
+    bool property(const char* name, bool (*convert)(std::string_view, std::string&), std::string& out) {
+        const char* value = udev_device_get_property_value(m_dev, name);
+        return value && convert(value, out);
+    }
+
+    // udev escapes unsafe bytes as "\xNN".
+    static std::string decode(const char* enc) {
+        std::string out;
+        for (const char* p = enc; *p; ++p) {
+            if (p[0] == '\\' && p[1] == 'x' && hexDigitValue(p[2]) >= 0 && hexDigitValue(p[3]) >= 0) {
+                out += char(hexDigitValue(p[2]) << 4 | hexDigitValue(p[3]));
+                p += 3;
+            } else {
+                out += *p;
+            }
+        }
+        return out;
+    }
+
+    struct udev_device* m_dev;
+    std::string m_busnum;
+    std::string m_class;
+};
+
+#endif // UDEVATTRS_H
@@ -0,0 +1,156 @@
+#include "uevent.h"
+#include <cstdio>
+#include <cstring>
+#include <sys/sysmacros.h>
+#include "usbkey.h"
+
+namespace {
+
+bool parseDecimal(std::string_view text, unsigned long long& out) {
+    if (text.empty() || text.size() > 20) {
+        return false;
+    }
+    out = 0;
+    for (char c : text) {
+        if (c < '0' || c > '9') {
+            return false;
+        }
+        out = out * 10 + unsigned(c - '0');
+    }
+    return true;
+}
+
+// Hex field of PRODUCT up to '/' or the end; 1-4 digits.
+bool parseHexField(std::string_view& text, uint16_t& out) {
+    size_t len = 0;
+    uint32_t value = 0;
+    while (len < text.size() && text[len] != '/') {
+        int d = hexDigitValue(text[len]);
+        if (d < 0 || len == 4) {
+            return false;
+        }
+        value = (value << 4) | uint32_t(d);
+        ++len;
+    }
+    if (len == 0) {
+        return false;
+    }
+    out = uint16_t(value);
+    text.remove_prefix(len);
+    return true;
+}
+
+} // namespace
+
+bool Uevent::parse(const char* data, size_t size) {
+    *this = Uevent();
+    const char* end = data + size;
+    const char* header = data;
+    const char* nul = static_cast<const char*>(memchr(header, '\0', size));
+    if (!nul || !memchr(header, '@', size_t(nul - header))) {
+        return false;
+    }
+    m_data = data;
+    m_size = size;
+
+    for (const char* p = nul + 1; p < end; ) {
+        const char* entryEnd = static_cast<const char*>(memchr(p, '\0', size_t(end - p)));
+        if (!entryEnd) {
+            break;   // unterminated tail, ignored
+        }
+        std::string_view entry(p, size_t(entryEnd - p));
+        p = entryEnd + 1;
+        size_t eq = entry.find('=');
+        if (eq == std::string_view::npos) {
+            continue;
+        }
+        std::string_view key = entry.substr(0, eq);
+        std::string_view value = entry.substr(eq + 1);
+        unsigned long long number;
+        switch (key.size()) {
+        case 4:
+            if (key == "TYPE") type = value;
+            break;
+        case 5:
+            if (key == "MAJOR" && parseDecimal(value, number)) major = unsigned(number);
+            else if (key == "MINOR" && parseDecimal(value, number)) minor = unsigned(number);
+            break;
+        case 6:
+            if (key == "ACTION") action = value;
+            else if (key == "SEQNUM" && parseDecimal(value, number)) seqnum = number;
+            else if (key == "BUSNUM") busnum = value;
+            break;
+        case 7:
+            if (key == "DEVPATH") devpath = value;
+            else if (key == "DEVTYPE") devtype = value;
+            else if (key == "PRODUCT") product = value;
+            break;
+        case 9:
+            if (key == "SUBSYSTEM") subsystem = value;
+            break;
+        default:
+            break;
+        }
+    }
+    return !action.empty() && !devpath.empty();
+}
+
+std::string_view Uevent::get(std::string_view key) const {
+    const char* end = m_data + m_size;
+    const char* p = m_data ? static_cast<const char*>(memchr(m_data, '\0', m_size)) : nullptr;
+    while (p && ++p < end) {
+        const char* entryEnd = static_cast<const char*>(memchr(p, '\0', size_t(end - p)));
+        if (!entryEnd) {
+            break;
+        }
+        std::string_view entry(p, size_t(entryEnd - p));
+        if (entry.size() > key.size() && entry[key.size()] == '=' && entry.compare(0, key.size(), key) == 0) {
+            return entry.substr(key.size() + 1);
+        }
+        p = entryEnd;
+    }
+    return std::string_view();
+}
+
+dev_t Uevent::devnum() const {
+    return makedev(major, minor);
+}
+
+bool parseUeventProduct(std::string_view product, uint32_t& key) {
+    uint16_t vid, pid;
+    if (!parseHexField(product, vid) || product.empty() || product[0] != '/') {
+        return false;
+    }
+    product.remove_prefix(1);
+    if (!parseHexField(product, pid)) {
+        return false;
+    }
+    key = makeUsbKey(vid, pid);
+    return true;
+}
+
+bool ueventBusNum(std::string_view busnum, std::string& out) {
+    if (busnum.empty() || busnum.size() > 3 || busnum.find_first_not_of("0123456789") != std::string_view::npos) {
+        return false;
+    }
+    while (busnum.size() > 1 && busnum[0] == '0') {
+        busnum.remove_prefix(1);
+    }
+    out.assign(busnum);
+    return true;
+}
+
+bool ueventDeviceClass(std::string_view type, std::string& out) {
+    unsigned value = 0;
+    size_t digits = 0;
+    for (; digits < type.size() && type[digits] >= '0' && type[digits] <= '9'; ++digits) {
+        value = value * 10 + unsigned(type[digits] - '0');
+    }
+    if (digits == 0 || digits > 3 || value > 0xff) {
+        return false;
+    }
+    char buf[4];
+    snprintf(buf, sizeof(buf), "%02x", value);
+    out = buf;
+    return true;
+}
@@ -0,0 +1,49 @@
+#ifndef UEVENT_H
+#define UEVENT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <sys/types.h>
+
+// One kernel uevent as sent on NETLINK_KOBJECT_UEVENT: an "action@devpath"
+// header, then KEY=value pairs, each NUL-terminated. parse() only records
+// views into the message, so nothing is copied; every view ends at a NUL
+// in the buffer and can be handed to C APIs through data().
+struct Uevent {
+    std::string_view action;
+    std::string_view devpath;
+    std::string_view subsystem;
+    std::string_view devtype;
+    std::string_view product;   // "vid/pid/bcdDevice", hex without leading zeros
+    std::string_view type;      // "class/subclass/protocol", decimal
+    std::string_view busnum;
+    uint64_t seqnum = 0;
+    unsigned major = 0;
+    unsigned minor = 0;
+
+    // False for messages that aren't kernel uevents (e.g. udevd's "libudev"
+    // ones) or lack ACTION/DEVPATH.
+    bool parse(const char* data, size_t size);
+
+    // Any other key; a linear scan over the message.
+    std::string_view get(std::string_view key) const;
+
+    bool isUsbDevice() const { return subsystem == "usb" && devtype == "usb_device"; }
+    dev_t devnum() const;
+
+private:
+    const char* m_data = nullptr;
+    size_t m_size = 0;
+};
+
+// VID:PID key from a PRODUCT= value ("781/5567/100").
+bool parseUeventProduct(std::string_view product, uint32_t& key);
+
+// BUSNUM= ("001") and TYPE= ("9/0/1") in the formats DeviceAttrs uses for
+// busnum and class ("1", "09").
+bool ueventBusNum(std::string_view busnum, std::string& out);
+bool ueventDeviceClass(std::string_view type, std::string& out);
+
+#endif // UEVENT_H
@@ -0,0 +1,109 @@
+#include "ueventattrs.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <vector>
+
+namespace {
+
+// Contents of a sysfs attribute without the trailing newline.
+bool readAttrFile(int dirfd, const char* name, std::string& out) {
+    int fd = openat(dirfd, name, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    char buf[256];
+    ssize_t len = read(fd, buf, sizeof(buf));
+    close(fd);
+    if (len < 0) {
+        return false;
+    }
+    while (len > 0 && (buf[len - 1] == '\n' || buf[len - 1] == '\0')) {
+        --len;
+    }
+    out.assign(buf, size_t(len));
+    return true;
+}
+
+} // namespace
+
+const char* UeventDeviceAttrs::fetch(DeviceAttr attr) {
+    std::string& out = m_values[size_t(attr)];
+    switch (attr) {
+    case DeviceAttr::BusNum:
+        return ueventBusNum(m_event.busnum, out) ? out.c_str() : readSysfs("busnum", out);
+    case DeviceAttr::DeviceClass:
+        return ueventDeviceClass(m_event.type, out) ? out.c_str() : readSysfs("bDeviceClass", out);
+    case DeviceAttr::InterfaceClass: return readInterfaceClasses(out);
+    case DeviceAttr::Manufacturer:   return readSysfs("manufacturer", out);
+    case DeviceAttr::Product:        return readSysfs("product", out);
+    case DeviceAttr::Serial:         return readSysfs("serial", out);
+    default:                         return nullptr;
+    }
+}
+
+const char* UeventDeviceAttrs::readSysfs(const char* name, std::string& out) {
+    std::string dir = "/sys" + std::string(m_event.devpath);
+    int dirfd = open(dir.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dirfd < 0) {
+        return nullptr;
+    }
+    bool ok = readAttrFile(dirfd, name, out);
+    close(dirfd);
+    return ok ? out.c_str() : nullptr;
+}
+
+// Same format as udev's ID_USB_INTERFACES: ":ccsspp:" per distinct interface.
+// Parsed from the raw descriptors, as usb_id does: at the device's "add"
+// the interface directories don't exist yet.
+const char* UeventDeviceAttrs::readInterfaceClasses(std::string& out) {
+    std::string path = "/sys" + std::string(m_event.devpath) + "/descriptors";
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return nullptr;
+    }
+    // The device descriptor, then every configuration with its interfaces
+    // and endpoints: length/type records.
+    std::vector<uint8_t> data(4096);
+    size_t size = 0;
+    for (;;) {
+        if (size == data.size()) {
+            data.resize(data.size() * 2);
+        }
+        ssize_t len = read(fd, data.data() + size, data.size() - size);
+        if (len < 0 && errno == EINTR) {
+            continue;
+        }
+        if (len <= 0) {
+            break;
+        }
+        size += size_t(len);
+    }
+    close(fd);
+
+    const uint8_t kInterface = 0x04;
+    std::vector<std::string> interfaces;
+    for (size_t pos = 0; pos + 2 <= size && data[pos] >= 2; pos += data[pos]) {
+        const uint8_t* desc = &data[pos];
+        if (desc[1] != kInterface || desc[0] < 9 || pos + 9 > size) {
+            continue;
+        }
+        char id[8];
+        std::snprintf(id, sizeof(id), "%02x%02x%02x", desc[5], desc[6], desc[7]);
+        if (std::find(interfaces.begin(), interfaces.end(), id) == interfaces.end()) {
+            interfaces.push_back(id);
+        }
+    }
+    if (interfaces.empty()) {
+        return nullptr;
+    }
+    std::sort(interfaces.begin(), interfaces.end());
+    out = ":";
+    for (const std::string& id : interfaces) {
+        out += id + ":";
+    }
+    return out.c_str();
+}
@@ -0,0 +1,27 @@
+#ifndef UEVENTATTRS_H
+#define UEVENTATTRS_H
+
+#include <string>
+#include "deviceattrs.h"
+#include "uevent.h"
+
+// DeviceAttrs for a raw kernel uevent. busnum and the device class come
+// from the message itself; the strings and the interface classes are read
+// from sysfs, and only when a condition or the log asks for them. Values
+// use the same formats as UdevDeviceAttrs.
+class UeventDeviceAttrs : public DeviceAttrs {
+public:
+    explicit UeventDeviceAttrs(const Uevent& event) : m_event(event) {}
+
+protected:
+    const char* fetch(DeviceAttr attr) override;
+
+private:
+    const char* readSysfs(const char* name, std::string& out);
+    const char* readInterfaceClasses(std::string& out);
+
+    const Uevent& m_event;
+    std::string m_values[kDeviceAttrCount];
+};
+
+#endif // UEVENTATTRS_H
@@ -0,0 +1,494 @@
+#include "ueventfilter.h"
+#include <algorithm>
+#include <cerrno>
+#include <arpa/inet.h>
+#include <cstdio>
+#include <cstring>
+#include <set>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+const uint32_t kAccept = 0xffffffffu;
+const uint32_t kDrop = 0;
+const size_t kMaxWindow = 1024;
+const size_t kMinWindow = 256;
+// udevd's messages: a 40-byte "libudev" header, then the properties with
+// ACTION= among the first few.
+const uint32_t kUdevHeader = 40;
+const uint32_t kUdevActionWindow = 64;
+// Fields of libudev's monitor_netlink_header, in network order.
+const uint32_t kUdevMagicOffset = 8;
+const uint32_t kUdevSubsystemOffset = 24;
+const uint32_t kUdevDevtypeOffset = 28;
+const uint32_t kUdevMagic = 0xfeedcafe;
+
+// libudev's string_hash32() (MurmurHash2, seed 0), which udevd stores in
+// the header for the subsystem and devtype.
+uint32_t udevHash(const char* s) {
+    const uint32_t m = 0x5bd1e995;
+    size_t len = strlen(s);
+    uint32_t h = uint32_t(len);
+    const uint8_t* data = reinterpret_cast<const uint8_t*>(s);
+    for (; len >= 4; data += 4, len -= 4) {
+        uint32_t k;
+        memcpy(&k, data, sizeof(k));
+        k *= m;
+        k ^= k >> 24;
+        k *= m;
+        h *= m;
+        h ^= k;
+    }
+    switch (len) {
+    case 3: h ^= uint32_t(data[2]) << 16; [[fallthrough]];
+    case 2: h ^= uint32_t(data[1]) << 8; [[fallthrough]];
+    case 1: h ^= data[0]; h *= m;
+    }
+    h ^= h >> 13;
+    h *= m;
+    h ^= h >> 15;
+    return h;
+}
+
+// Scratch memory slots.
+enum : uint32_t { VidSlot, PidSlot, KeySlot, IndexSlot, TmpSlot };
+
+// Four characters as BPF_W loads them (network order).
+uint32_t word(const char* s) {
+    return (uint32_t(uint8_t(s[0])) << 24) | (uint32_t(uint8_t(s[1])) << 16) | (uint32_t(uint8_t(s[2])) << 8)
+         | uint32_t(uint8_t(s[3]));
+}
+
+class Emitter {
+public:
+    explicit Emitter(std::vector<struct sock_filter>& code) : m_code(code) {}
+
+    void stmt(uint16_t code, uint32_t k) {
+        m_code.push_back(BPF_STMT(code, k));
+    }
+    void jump(uint16_t code, uint32_t k, uint8_t jt, uint8_t jf) {
+        m_code.push_back(BPF_JUMP(code, k, jt, jf));
+    }
+    void accept() { stmt(BPF_RET | BPF_K, kAccept); }
+
+    // Unconditional jump to a later position, patched with land().
+    size_t forward() {
+        stmt(BPF_JMP | BPF_JA, 0);
+        return m_code.size() - 1;
+    }
+    void land(const std::vector<size_t>& jumps) {
+        for (size_t at : jumps) {
+            m_code[at].k = uint32_t(m_code.size() - at - 1);
+        }
+    }
+
+    size_t size() const { return m_code.size(); }
+
+private:
+    std::vector<struct sock_filter>& m_code;
+};
+
+// Hex digits at X up to '/', into slot. Leaves X and IndexSlot on the
+// character after the '/'. More than four digits isn't a USB id: accept.
+void emitHexField(Emitter& e, uint32_t slot) {
+    std::vector<size_t> done;
+    for (uint32_t i = 0; i <= 4; ++i) {
+        e.stmt(BPF_LD | BPF_B | BPF_IND, i);
+        if (i > 0) {
+            e.jump(BPF_JMP | BPF_JEQ | BPF_K, '/', 0, 5);
+            e.stmt(BPF_LD | BPF_MEM, IndexSlot);
+            e.stmt(BPF_ALU | BPF_ADD | BPF_K, i + 1);
+            e.stmt(BPF_ST, IndexSlot);
+            e.stmt(BPF_MISC | BPF_TAX, 0);
+            done.push_back(e.forward());
+        }
+        if (i == 4) {
+            e.accept();
+            break;
+        }
+        // digit = (c & 0xf) + 9 * (c >> 6), for 0-9, a-f and A-F; X is
+        // free until IndexSlot is reloaded.
+        e.stmt(BPF_ST, TmpSlot);
+        e.stmt(BPF_ALU | BPF_RSH | BPF_K, 6);
+        e.stmt(BPF_ALU | BPF_MUL | BPF_K, 9);
+        e.stmt(BPF_MISC | BPF_TAX, 0);
+        e.stmt(BPF_LD | BPF_MEM, TmpSlot);
+        e.stmt(BPF_ALU | BPF_AND | BPF_K, 0xf);
+        e.stmt(BPF_ALU | BPF_ADD | BPF_X, 0);
+        if (i > 0) {
+            e.stmt(BPF_MISC | BPF_TAX, 0);
+            e.stmt(BPF_LD | BPF_MEM, slot);
+            e.stmt(BPF_ALU | BPF_LSH | BPF_K, 4);
+            e.stmt(BPF_ALU | BPF_ADD | BPF_X, 0);
+        }
+        e.stmt(BPF_ST, slot);
+        e.stmt(BPF_LDX | BPF_MEM, IndexSlot);
+    }
+    e.land(done);
+}
+
+// Entered with X on the byte before a possible "PRODUCT=". Ends with the
+// packed VID:PID in KeySlot and A, and accepts when it matches.
+void emitMatch(Emitter& e, const std::vector<UsbPattern>& patterns) {
+    // A key starts after a NUL, so "PRODUCT=" inside a value doesn't count.
+    e.stmt(BPF_LD | BPF_B | BPF_IND, 0);
+    e.jump(BPF_JMP | BPF_JEQ | BPF_K, 0, 1, 0);
+    e.accept();
+    e.stmt(BPF_LD | BPF_W | BPF_IND, 1);
+    e.jump(BPF_JMP | BPF_JEQ | BPF_K, word("PROD"), 1, 0);
+    e.accept();
+    e.stmt(BPF_LD | BPF_W | BPF_IND, 5);
+    e.jump(BPF_JMP | BPF_JEQ | BPF_K, word("UCT="), 1, 0);
+    e.accept();
+    e.stmt(BPF_MISC | BPF_TXA, 0);
+    e.stmt(BPF_ALU | BPF_ADD | BPF_K, 9);
+    e.stmt(BPF_ST, IndexSlot);
+    e.stmt(BPF_MISC | BPF_TAX, 0);
+
+    emitHexField(e, VidSlot);
+    emitHexField(e, PidSlot);
+    e.stmt(BPF_LDX | BPF_MEM, PidSlot);
+    e.stmt(BPF_LD | BPF_MEM, VidSlot);
+    e.stmt(BPF_ALU | BPF_LSH | BPF_K, 16);
+    e.stmt(BPF_ALU | BPF_OR | BPF_X, 0);
+    e.stmt(BPF_ST, KeySlot);
+
+    bool keyInA = true;
+    auto key = [&] {
+        if (!keyInA) {
+            e.stmt(BPF_LD | BPF_MEM, KeySlot);
+            keyInA = true;
+        }
+    };
+    for (const UsbPattern& p : patterns) {
+        uint32_t vid = uint32_t(p.vid) << 16;
+        key();
+        if (p.kind == UsbPattern::Mask) {
+            e.stmt(BPF_ALU | BPF_AND | BPF_K, (p.any_vid ? 0 : 0xffff0000u) | p.mask);
+            keyInA = false;
+            e.jump(BPF_JMP | BPF_JEQ | BPF_K, (p.any_vid ? 0 : vid) | p.value, 0, 1);
+        } else if (p.kind == UsbPattern::Exact) {
+            e.jump(BPF_JMP | BPF_JEQ | BPF_K, vid | p.lo, 0, 1);
+        } else {
+            if (p.any_vid) {
+                e.stmt(BPF_ALU | BPF_AND | BPF_K, 0xffff);
+                keyInA = false;
+                vid = 0;
+            }
+            e.jump(BPF_JMP | BPF_JGE | BPF_K, vid | p.lo, 0, 2);
+            e.jump(BPF_JMP | BPF_JGT | BPF_K, vid | p.hi, 1, 0);
+        }
+        e.accept();
+    }
+    e.stmt(BPF_RET | BPF_K, kDrop);
+}
+
+bool samePattern(const UsbPattern& a, const UsbPattern& b) {
+    return a.kind == b.kind && a.any_vid == b.any_vid && a.vid == b.vid && a.lo == b.lo && a.hi == b.hi
+        && a.value == b.value && a.mask == b.mask;
+}
+
+bool patternMatches(const UsbPattern& p, uint32_t key) {
+    if (!p.any_vid && usbKeyVid(key) != p.vid) {
+        return false;
+    }
+    uint16_t pid = usbKeyPid(key);
+    if (p.kind == UsbPattern::Mask) {
+        return (pid & p.mask) == p.value;
+    }
+    return pid >= p.lo && pid <= p.hi;
+}
+
+// Keys inside, at the edges of and just outside a pattern.
+void sampleKeys(const UsbPattern& p, std::set<uint32_t>& keys) {
+    std::vector<uint16_t> vids;
+    if (p.any_vid) {
+        vids = {0x0000, 0x1d6b, 0xffff};
+    } else {
+        vids = {p.vid, uint16_t(p.vid ^ 1)};
+    }
+    std::vector<uint16_t> pids;
+    if (p.kind == UsbPattern::Mask) {
+        pids = {p.value, uint16_t(p.value | ~p.mask)};
+        if (p.mask) {
+            pids.push_back(uint16_t(p.value ^ (p.mask & -p.mask)));
+        }
+    } else {
+        pids = {p.lo, p.hi, uint16_t(p.lo + (p.hi - p.lo) / 2)};
+        if (p.lo > 0) {
+            pids.push_back(uint16_t(p.lo - 1));
+        }
+        if (p.hi < 0xffff) {
+            pids.push_back(uint16_t(p.hi + 1));
+        }
+    }
+    for (uint16_t vid : vids) {
+        for (uint16_t pid : pids) {
+            keys.insert(makeUsbKey(vid, pid));
+        }
+    }
+}
+
+// A uevent as the kernel or udevd sends it. product is null for one
+// without PRODUCT=; padding puts a filler property before it.
+std::string craftMessage(bool udev, const char* action, const char* subsystem, const char* devtype,
+                         const char* product, size_t padding) {
+    static const char kDevpath[] = "/devices/pci0000:00/0000:00:14.0/usb1/1-1";
+    std::string properties = std::string("ACTION=") + action + '\0' + "DEVPATH=" + kDevpath + '\0'
+                           + "SUBSYSTEM=" + subsystem + '\0' + "DEVTYPE=" + devtype + '\0';
+    if (padding) {
+        properties += "ID_FILLER=" + std::string(padding, 'x') + '\0';
+    }
+    if (product) {
+        properties += std::string("PRODUCT=") + product + '\0';
+    }
+    properties += std::string("SEQNUM=1") + '\0';
+    if (!udev) {
+        return std::string(action) + '@' + kDevpath + '\0' + properties;
+    }
+    uint32_t header[kUdevHeader / 4] = {};
+    memcpy(header, "libudev", 8);
+    header[kUdevMagicOffset / 4] = htonl(kUdevMagic);
+    header[3] = kUdevHeader;
+    header[4] = kUdevHeader;
+    header[5] = uint32_t(properties.size());
+    header[kUdevSubsystemOffset / 4] = htonl(udevHash(subsystem));
+    header[kUdevDevtypeOffset / 4] = htonl(udevHash(devtype));
+    return std::string(reinterpret_cast<const char*>(header), sizeof(header)) + properties;
+}
+
+std::string usbMessage(bool udev, const char* action, const char* product, size_t padding) {
+    return craftMessage(udev, action, UeventFilter::kUdevSubsystem, UeventFilter::kUdevDevtype, product, padding);
+}
+
+struct Case {
+    std::string name;
+    std::string message;
+    bool pass;
+};
+
+// The messages every program must judge right, and keys around the
+// patterns: all of them when exhaustive, else the first and last only.
+std::vector<Case> makeCases(const std::vector<UsbPattern>& patterns, size_t window, bool exhaustive) {
+    std::set<uint32_t> keys;
+    for (size_t i = 0; i < patterns.size(); ++i) {
+        if (exhaustive || i == 0 || i + 1 == patterns.size()) {
+            sampleKeys(patterns[i], keys);
+        }
+    }
+    std::vector<Case> cases;
+    for (bool udev : {false, true}) {
+        const char* source = udev ? "udevd" : "jądro";
+        char product[32];
+        for (uint32_t key : keys) {
+            bool pass = false;
+            for (const UsbPattern& p : patterns) {
+                pass = pass || patternMatches(p, key);
+            }
+            char text[10];
+            std::snprintf(product, sizeof(product), "%x/%x/100", usbKeyVid(key), usbKeyPid(key));
+            cases.push_back({std::string(source) + " add " + formatUsbKey(key, text),
+                             usbMessage(udev, "add", product, 0), pass});
+        }
+        // Neither a removal nor a message past the window is judged by key.
+        std::snprintf(product, sizeof(product), "%x/%x/100", 0xdead, 0xbeef);
+        cases.push_back({std::string(source) + " remove", usbMessage(udev, "remove", product, 0), true});
+        cases.push_back({std::string(source) + " add, PRODUCT= poza oknem", usbMessage(udev, "add", product, window),
+                         true});
+        cases.push_back({std::string(source) + " add bez PRODUCT=", usbMessage(udev, "add", nullptr, 0), false});
+    }
+    // udevd's other subsystems are dropped by the header, however long.
+    cases.push_back({"udevd add block", craftMessage(true, "add", "block", "disk", nullptr, window), false});
+    cases.push_back({"udevd remove block", craftMessage(true, "remove", "block", "disk", nullptr, 0), false});
+    cases.push_back({"udevd add usb_interface",
+                     craftMessage(true, "add", UeventFilter::kUdevSubsystem, "usb_interface", "1/2/100", 0), false});
+    return cases;
+}
+
+bool install(int fd, const std::vector<struct sock_filter>& code) {
+    struct sock_fprog program;
+    program.len = static_cast<unsigned short>(code.size());
+    program.filter = const_cast<struct sock_filter*>(code.data());
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == 0;
+}
+
+} // namespace
+
+bool UeventFilter::compile(const RuleTable& rules, std::string* reason) {
+    m_program.clear();
+    m_window = 0;
+    m_patterns.clear();
+
+    std::vector<UsbPattern> patterns;
+    if (!rules.usbPatterns(patterns)) {
+        if (reason) *reason = "reguły portów pasują do dowolnego VID:PID";
+        return false;
+    }
+    for (const UsbPattern& p : patterns) {
+        if (p.any_vid && p.kind == UsbPattern::Range && p.lo == 0 && p.hi == 0xffff) {
+            if (reason) *reason = "reguła \"*:*\" pasuje do każdego urządzenia";
+            m_patterns.clear();
+            return false;
+        }
+        bool seen = false;
+        for (const UsbPattern& u : m_patterns) {
+            seen = seen || samePattern(p, u);
+        }
+        if (!seen) {
+            m_patterns.push_back(p);
+        }
+    }
+    // A narrower window leaves more room for the matcher.
+    for (size_t window = kMaxWindow; !build(window); window /= 2) {
+        if (window / 2 < kMinWindow) {
+            if (reason) *reason = "za dużo wzorców VID:PID (" + std::to_string(m_patterns.size()) + ")";
+            return false;
+        }
+    }
+    return true;
+}
+
+// Three parts: removals are let through; then "PRODUCT=" is searched for in
+// the first window bytes and handed to the matcher; a message that ends
+// first is dropped, since a load past its end drops it.
+//
+// Both searches load aligned words and compare them with the four shifted
+// forms of the key, one of which covers any occurrence.
+bool UeventFilter::build(size_t window) {
+    m_program.clear();
+    m_window = 0;
+
+    std::vector<struct sock_filter> match;
+    Emitter tail(match);
+    emitMatch(tail, m_patterns);
+
+    Emitter e(m_program);
+    std::vector<size_t> toProduct;
+    // Kernel messages start with "action@devpath".
+    e.stmt(BPF_LD | BPF_W | BPF_ABS, 0);
+    e.jump(BPF_JMP | BPF_JEQ | BPF_K, word("remo"), 0, 1);
+    e.accept();
+    e.jump(BPF_JMP | BPF_JEQ | BPF_K, word("libu"), 1, 0);
+    toProduct.push_back(e.forward());
+    // What libudev's own filter for the monitor's usb/usb_device match
+    // checked, so other subsystems are still dropped whatever their length.
+    e.stmt(BPF_LD | BPF_W | BPF_ABS, kUdevMagicOffset);
+    e.jump(BPF_JMP | BPF_JEQ | BPF_K, kUdevMagic, 1, 0);
+    toProduct.push_back(e.forward());
+    e.stmt(BPF_LD | BPF_W | BPF_ABS, kUdevSubsystemOffset);
+    e.jump(BPF_JMP | BPF_JEQ | BPF_K, udevHash(kUdevSubsystem), 1, 0);
+    e.stmt(BPF_RET | BPF_K, kDrop);
+    e.stmt(BPF_LD | BPF_W | BPF_ABS, kUdevDevtypeOffset);
+    e.jump(BPF_JMP | BPF_JEQ | BPF_K, udevHash(kUdevDevtype), 1, 0);
+    e.stmt(BPF_RET | BPF_K, kDrop);
+    static const char kAction[] = "ACTION=r";
+    std::vector<size_t> toAction;
+    for (uint32_t off = kUdevHeader; off < kUdevHeader + kUdevActionWindow; off += 4) {
+        e.stmt(BPF_LD | BPF_W | BPF_ABS, off);
+        for (uint8_t k = 0; k < 4; ++k) {
+            e.jump(BPF_JMP | BPF_JEQ | BPF_K, word(kAction + k), uint8_t(3 + k), k == 3 ? 8 : 0);
+        }
+        for (uint32_t k = 0; k < 4; ++k) {
+            e.stmt(BPF_LDX | BPF_IMM, off - k);
+            toAction.push_back(e.forward());
+        }
+    }
+    toProduct.push_back(e.forward());
+    e.land(toAction);
+    // ACTION= is there only once; X is on it.
+    e.stmt(BPF_LD | BPF_W | BPF_IND, 4);
+    e.jump(BPF_JMP | BPF_JEQ | BPF_K, word("ON=r"), 0, 1);
+    e.accept();
+    e.land(toProduct);
+
+    static const char kProduct[] = "PRODUCT=";
+    std::vector<size_t> toMatch;
+    for (uint32_t off = 4; off < window; off += 4) {
+        e.stmt(BPF_LD | BPF_W | BPF_ABS, off);
+        for (uint8_t k = 0; k < 4; ++k) {
+            e.jump(BPF_JMP | BPF_JEQ | BPF_K, word(kProduct + k), uint8_t(3 + k), k == 3 ? 8 : 0);
+        }
+        for (uint32_t k = 0; k < 4; ++k) {
+            e.stmt(BPF_LDX | BPF_IMM, off - k - 1);
+            toMatch.push_back(e.forward());
+        }
+    }
+    // Not within the window: can't tell.
+    e.accept();
+    e.land(toMatch);
+    m_program.insert(m_program.end(), match.begin(), match.end());
+
+    if (m_program.size() > BPF_MAXINSNS) {
+        m_program.clear();
+        return false;
+    }
+    m_window = window;
+    return true;
+}
+
+bool UeventFilter::attach(int fd, std::string* error) {
+    for (;;) {
+        // On a socketpair first: a program that misjudges a message must
+        // never see real events.
+        int attachError = 0;
+        if (!check(false, error, &attachError) && attachError == 0) {
+            return false;
+        }
+        if (attachError == 0) {
+            if (install(fd, m_program)) {
+                return true;
+            }
+            attachError = errno;
+            if (error) *error = std::string("SO_ATTACH_FILTER: ") + strerror(attachError);
+        }
+        // The converted program is charged against net.core.optmem_max.
+        if (attachError != ENOMEM || m_window / 2 < kMinWindow || !build(m_window / 2)) {
+            return false;
+        }
+    }
+}
+
+bool UeventFilter::detach(int fd) {
+    int unused = 0;
+    return setsockopt(fd, SOL_SOCKET, SO_DETACH_FILTER, &unused, sizeof(unused)) == 0 || errno == ENOENT;
+}
+
+bool UeventFilter::verify(std::string* error) const {
+    return check(true, error, nullptr);
+}
+
+bool UeventFilter::check(bool exhaustive, std::string* error, int* attachError) const {
+    std::vector<Case> cases = makeCases(m_patterns, m_window, exhaustive);
+    int fds[2];
+    if (socketpair(AF_UNIX, SOCK_DGRAM | SOCK_CLOEXEC, 0, fds) != 0) {
+        if (error) *error = std::string("socketpair: ") + strerror(errno);
+        return false;
+    }
+    bool ok = install(fds[1], m_program);
+    if (!ok) {
+        if (attachError) *attachError = errno;
+        if (error) *error = std::string("SO_ATTACH_FILTER: ") + strerror(errno);
+    }
+    std::vector<char> buffer(kMaxWindow * 2);
+    for (size_t i = 0; ok && i < cases.size(); ++i) {
+        const Case& c = cases[i];
+        if (send(fds[0], c.message.data(), c.message.size(), MSG_DONTWAIT | MSG_NOSIGNAL) < 0) {
+            if (error) *error = std::string("send: ") + strerror(errno);
+            ok = false;
+            break;
+        }
+        // Datagrams between a socketpair's ends are delivered within send().
+        bool passed = recv(fds[1], buffer.data(), buffer.size(), MSG_DONTWAIT) >= 0;
+        if (passed != c.pass) {
+            if (error) {
+                *error = "błędny program, " + c.name
+                       + (passed ? ": przepuszczony, powinien być odrzucony" : ": odrzucony, powinien przejść");
+            }
+            ok = false;
+        }
+    }
+    close(fds[0]);
+    close(fds[1]);
+    return ok;
+}
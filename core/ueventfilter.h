@@ -0,0 +1,67 @@
+#ifndef UEVENTFILTER_H
+#define UEVENTFILTER_H
+
+#include <cstddef>
+#include <string>
+#include <vector>
+#include <linux/filter.h>
+#include "ruletable.h"
+
+// Classic BPF socket filter compiled from the VID:PID patterns of a rule
+// table, so uevents of devices no rule can match are dropped in the kernel
+// and never wake the daemon. Works on kernel uevents and on udevd's
+// messages alike: both carry the kernel's "PRODUCT=vid/pid/bcd" property.
+//
+// cBPF can only jump forward, so the search for PRODUCT= is unrolled over
+// the first window() bytes of the message. A message is let through when
+//  - its PRODUCT= matches a pattern,
+//  - it is a removal (kernel "remove@" header, or udevd's ACTION=remove
+//    among the first properties), so devices are always seen leaving,
+//  - PRODUCT= isn't within the window, or anything looks unexpected.
+// It is dropped when it ends without PRODUCT= or the VID:PID matches no
+// pattern, and a udevd message also when its header's subsystem/devtype
+// hashes aren't those of kUdevSubsystem/kUdevDevtype, as libudev's own
+// filter would. Whatever passes is still checked in userspace.
+class UeventFilter {
+public:
+    // The only udevd messages the filter lets through; the monitor's
+    // match must be the same.
+    static constexpr const char* kUdevSubsystem = "usb";
+    static constexpr const char* kUdevDevtype = "usb_device";
+
+    // False if the rules can't be expressed as a filter (port rules, "*:*",
+    // too many patterns for one program); reason says why.
+    bool compile(const RuleTable& rules, std::string* reason = nullptr);
+
+    // Replaces the socket's filter, including the one libudev attaches,
+    // after trying the program on a few crafted messages over a socketpair.
+    // If the kernel refuses the program as too large (net.core.optmem_max),
+    // the window is halved down to a minimum before giving up.
+    bool attach(int fd, std::string* error = nullptr);
+    // Lets everything through until the next attach().
+    static bool detach(int fd);
+
+    // Runs the program on crafted kernel and udevd messages, sent over an
+    // AF_UNIX datagram socketpair, and checks that exactly those that
+    // should get through do: keys inside, at the edges of and just outside
+    // every pattern, removals, other subsystems, messages without PRODUCT=
+    // and with it past the window. error names the first message that went
+    // the wrong way. Thousands of messages for big rule sets: a debugging
+    // aid (autotriggers --check-filter), attach() tries only a few.
+    bool verify(std::string* error = nullptr) const;
+
+    size_t size() const { return m_program.size(); }
+    size_t window() const { return m_window; }
+    size_t patternCount() const { return m_patterns.size(); }
+
+private:
+    bool build(size_t window);
+    // attachError gets errno when the socketpair refused the program.
+    bool check(bool exhaustive, std::string* error, int* attachError) const;
+
+    std::vector<UsbPattern> m_patterns;
+    std::vector<struct sock_filter> m_program;
+    size_t m_window = 0;
+};
+
+#endif // UEVENTFILTER_H
@@ -0,0 +1,97 @@
+#include "ueventsource.h"
+#include <cerrno>
+#include <cstring>
+#include <linux/netlink.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace {
+
+// The kernel's uevent buffer is 2 KiB of environment plus the header.
+const size_t kMessageSize = 8192;
+const unsigned kKernelGroup = 1;
+
+} // namespace
+
+struct UeventSource::Buffers {
+    char data[kBatch][kMessageSize];
+    struct sockaddr_nl senders[kBatch];
+    struct iovec iov[kBatch];
+    struct mmsghdr headers[kBatch];
+};
+
+UeventSource::UeventSource()
+    : m_fd(-1) {
+}
+
+UeventSource::~UeventSource() {
+    if (m_fd >= 0) {
+        close(m_fd);
+    }
+}
+
+bool UeventSource::open(int receiveBuffer, std::string* error) {
+    m_fd = socket(AF_NETLINK, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_KOBJECT_UEVENT);
+    if (m_fd < 0) {
+        if (error) *error = std::string("socket(NETLINK_KOBJECT_UEVENT): ") + strerror(errno);
+        return false;
+    }
+    if (receiveBuffer > 0 && setsockopt(m_fd, SOL_SOCKET, SO_RCVBUFFORCE, &receiveBuffer, sizeof(receiveBuffer)) != 0) {
+        setsockopt(m_fd, SOL_SOCKET, SO_RCVBUF, &receiveBuffer, sizeof(receiveBuffer));
+    }
+    struct sockaddr_nl addr = {};
+    addr.nl_family = AF_NETLINK;
+    addr.nl_groups = kKernelGroup;
+    if (bind(m_fd, reinterpret_cast<struct sockaddr*>(&addr), sizeof(addr)) != 0) {
+        if (error) *error = std::string("bind(NETLINK_KOBJECT_UEVENT): ") + strerror(errno);
+        close(m_fd);
+        m_fd = -1;
+        return false;
+    }
+    m_buffers.reset(new Buffers);
+    return true;
+}
+
+size_t UeventSource::receive(Uevent (&out)[kBatch], bool& overflow) {
+    Buffers& b = *m_buffers;
+    for (;;) {
+        for (size_t i = 0; i < kBatch; ++i) {
+            b.iov[i].iov_base = b.data[i];
+            b.iov[i].iov_len = kMessageSize;
+            struct msghdr& msg = b.headers[i].msg_hdr;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_name = &b.senders[i];
+            msg.msg_namelen = sizeof(b.senders[i]);
+            msg.msg_iov = &b.iov[i];
+            msg.msg_iovlen = 1;
+        }
+        int received = recvmmsg(m_fd, b.headers, kBatch, MSG_DONTWAIT, nullptr);
+        if (received < 0) {
+            if (errno == ENOBUFS) {
+                overflow = true;
+                continue;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            return 0;
+        }
+
+        size_t count = 0;
+        for (int i = 0; i < received; ++i) {
+            const struct msghdr& msg = b.headers[i].msg_hdr;
+            // Only the kernel (port id 0) may speak on this group; anything
+            // else is a spoofing attempt or a truncated message.
+            if (b.senders[i].nl_pid != 0 || (msg.msg_flags & MSG_TRUNC)) {
+                continue;
+            }
+            if (out[count].parse(b.data[i], b.headers[i].msg_len)) {
+                ++count;
+            }
+        }
+        // A batch made only of dropped messages isn't the end of the queue.
+        if (count > 0 || received == 0 || size_t(received) < kBatch) {
+            return count;
+        }
+    }
+}
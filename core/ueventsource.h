@@ -0,0 +1,40 @@
+#ifndef UEVENTSOURCE_H
+#define UEVENTSOURCE_H
+
+#include <cstddef>
+#include <memory>
+#include <string>
+#include "uevent.h"
+
+// NETLINK_KOBJECT_UEVENT socket on the kernel multicast group: events as
+// the kernel emits them, before (or without) udevd. Messages are received
+// in batches with recvmmsg into buffers owned by the source and parsed in
+// place.
+class UeventSource {
+public:
+    static const size_t kBatch = 64;
+
+    UeventSource();
+    ~UeventSource();
+
+    UeventSource(const UeventSource&) = delete;
+    UeventSource& operator=(const UeventSource&) = delete;
+
+    // receiveBuffer in bytes, 0 for the system default.
+    bool open(int receiveBuffer, std::string* error = nullptr);
+    int fd() const { return m_fd; }
+
+    // Receives up to kBatch messages with one syscall and parses them into
+    // out. The views stay valid until the next receive(). Returns 0 once
+    // the socket is empty. overflow is set if the kernel reported lost
+    // messages (ENOBUFS). Messages not sent by the kernel are dropped.
+    size_t receive(Uevent (&out)[kBatch], bool& overflow);
+
+private:
+    struct Buffers;
+
+    int m_fd;
+    std::unique_ptr<Buffers> m_buffers;
+};
+
+#endif // UEVENTSOURCE_H
@@ -0,0 +1,740 @@
+#include "usbengine.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <libudev.h>
+#include <sys/epoll.h>
+#include <thread>
+#include "configwatcher.h"
+#include "portpath.h"
+#include "ruleimage.h"
+#include "sysfsscan.h"
+#include "udevattrs.h"
+#include "ueventattrs.h"
+#include "ueventfilter.h"
+#include "ueventsource.h"
+#include "usbkey.h"
+
+namespace {
+
+// Upper bound of one drain, so the other sources still get their turn.
+const size_t kMaxBatch = 256;
+// Above this many vendors one full enumeration beats one per vendor.
+const size_t kMaxScanVendors = 16;
+
+bool isUsbDevice(struct udev_device* dev) {
+    const char* devtype = udev_device_get_devtype(dev);
+    return devtype && strcmp(devtype, "usb_device") == 0;
+}
+
+// VID:PID from the event's properties: the kernel's PRODUCT=, or udev's
+// ID_VENDOR_ID/ID_MODEL_ID. sysfs only for devices that have neither.
+bool udevDeviceKey(struct udev_device* dev, uint32_t& key) {
+    const char* product = udev_device_get_property_value(dev, "PRODUCT");
+    if (product && parseUeventProduct(product, key)) {
+        return true;
+    }
+    uint16_t vid, pid;
+    if ((parseUsbId(udev_device_get_property_value(dev, "ID_VENDOR_ID"), vid)
+         && parseUsbId(udev_device_get_property_value(dev, "ID_MODEL_ID"), pid))
+        || (parseUsbId(udev_device_get_sysattr_value(dev, "idVendor"), vid)
+            && parseUsbId(udev_device_get_sysattr_value(dev, "idProduct"), pid))) {
+        key = makeUsbKey(vid, pid);
+        return true;
+    }
+    return false;
+}
+
+AttachedDevice udevAttachedDevice(struct udev_device* dev) {
+    AttachedDevice device;
+    const char* devpath = udev_device_get_devpath(dev);
+    device.devpath = devpath ? devpath : "";
+    udevDeviceKey(dev, device.key);
+    device.devnum = udev_device_get_devnum(dev);
+    // From the udev database; sysfs is read only when a rule asks for it.
+    const char* serial = udev_device_get_property_value(dev, "ID_SERIAL_SHORT");
+    device.serial = serial ? serial : "";
+    device.seqnum = udev_device_get_seqnum(dev);
+    device.attached = std::chrono::system_clock::now();
+    return device;
+}
+
+AttachedDevice ueventAttachedDevice(const Uevent& event) {
+    AttachedDevice device;
+    device.devpath = std::string(event.devpath);
+    parseUeventProduct(event.product, device.key);
+    device.devnum = event.devnum();
+    device.seqnum = event.seqnum;
+    device.attached = std::chrono::system_clock::now();
+    return device;
+}
+
+// Syspaths of usb_device entries, only those with idVendor == vendor when
+// vendor >= 0. Returns false if udev can't enumerate.
+bool listUsbDevices(struct udev* udev, int vendor, std::vector<std::string>& out) {
+    struct udev_enumerate* enumerate = udev_enumerate_new(udev);
+    if (!enumerate) {
+        return false;
+    }
+    udev_enumerate_add_match_subsystem(enumerate, "usb");
+    udev_enumerate_add_match_property(enumerate, "DEVTYPE", "usb_device");
+    if (vendor >= 0) {
+        char value[8];
+        snprintf(value, sizeof(value), "%04x", unsigned(vendor));
+        udev_enumerate_add_match_sysattr(enumerate, "idVendor", value);
+    }
+    udev_enumerate_scan_devices(enumerate);
+
+    struct udev_list_entry* entry;
+    udev_list_entry_foreach(entry, udev_enumerate_get_list_entry(enumerate)) {
+        out.push_back(udev_list_entry_get_name(entry));
+    }
+    udev_enumerate_unref(enumerate);
+    return true;
+}
+
+// Calls f for every usb_device. Returns false if udev can't enumerate.
+template <typename F>
+bool forEachUsbDevice(struct udev* udev, F f) {
+    std::vector<std::string> syspaths;
+    if (!listUsbDevices(udev, -1, syspaths)) {
+        return false;
+    }
+    for (const std::string& syspath : syspaths) {
+        struct udev_device* dev = udev_device_new_from_syspath(udev, syspath.c_str());
+        if (dev) {
+            f(dev);
+            udev_device_unref(dev);
+        }
+    }
+    return true;
+}
+
+// Vendors a scan has to look at, or false if a rule accepts any VID (or
+// any device, for port rules) or there are too many to enumerate one by one.
+bool scanVendors(const RuleTable& rules, std::vector<uint16_t>& vendors) {
+    std::vector<UsbPattern> patterns;
+    if (!rules.usbPatterns(patterns)) {
+        return false;
+    }
+    for (const UsbPattern& pattern : patterns) {
+        if (pattern.any_vid) {
+            return false;
+        }
+        vendors.push_back(pattern.vid);
+    }
+    std::sort(vendors.begin(), vendors.end());
+    vendors.erase(std::unique(vendors.begin(), vendors.end()), vendors.end());
+    return vendors.size() <= kMaxScanVendors;
+}
+
+// The kernel's last uevent sequence number, 0 if unknown.
+uint64_t currentUeventSeqnum() {
+    unsigned long long seqnum = 0;
+    FILE* file = fopen("/sys/kernel/uevent_seqnum", "re");
+    if (file) {
+        if (fscanf(file, "%llu", &seqnum) != 1) {
+            seqnum = 0;
+        }
+        fclose(file);
+    }
+    return seqnum;
+}
+
+} // namespace
+
+UsbEngine::UsbEngine(ActionDispatcher::Mode mode, LogSink log)
+    : m_log(log),
+      m_dispatcher(mode, log),
+      m_rules(std::make_shared<RuleTable>()),
+      m_batchSizes(kMaxBatch),
+      m_receiveBuffer(kDefaultReceiveBuffer),
+      m_source(Udev),
+      m_socketFilter(true),
+      m_sysfsScan(false),
+      m_coldplug(false),
+      m_overflows(0) {
+}
+
+void UsbEngine::setReceiveBufferSize(int bytes) {
+    m_receiveBuffer = bytes;
+}
+
+void UsbEngine::setSource(Source source) {
+    m_source = source;
+}
+
+void UsbEngine::setSocketFilter(bool enabled) {
+    m_socketFilter = enabled;
+}
+
+void UsbEngine::setSysfsScan(bool enabled) {
+    m_sysfsScan = enabled;
+}
+
+void UsbEngine::setColdplug(bool enabled) {
+    m_coldplug = enabled;
+}
+
+void UsbEngine::setMaxConcurrent(size_t limit) {
+    m_dispatcher.setMaxConcurrent(limit);
+}
+
+void UsbEngine::setSpawner(Spawner* spawner) {
+    m_dispatcher.setSpawner(spawner);
+}
+
+void UsbEngine::setConfigPath(const std::string& configPath, const std::string& imagePath) {
+    std::lock_guard<std::mutex> lock(m_pathMutex);
+    m_paths.config = configPath;
+    m_paths.image = imagePath.empty() ? RuleImage::defaultPathFor(configPath) : imagePath;
+}
+
+UsbEngine::Paths UsbEngine::paths() {
+    std::lock_guard<std::mutex> lock(m_pathMutex);
+    return m_paths;
+}
+
+void UsbEngine::stop() {
+    m_reactor.stop();
+}
+
+void UsbEngine::resetStop() {
+    m_reactor.reset();
+}
+
+std::shared_ptr<const RuleTable> UsbEngine::loadRules(const Paths& paths, std::shared_ptr<const RuleTable> fallback) {
+    std::string error;
+    RuleLoadInfo info;
+    std::shared_ptr<const RuleTable> rules = RuleTable::load(paths.config, paths.image, &error, &info);
+    if (!info.image_error.empty()) {
+        m_log("[!] Pominięto obraz reguł: " + info.image_error);
+    }
+    if (!rules) {
+        m_log("[!] Błąd wczytywania konfiguracji: " + error);
+        return fallback;
+    }
+    if (rules->invalidRuleCount() > 0) {
+        m_log("[!] Pominięto " + std::to_string(rules->invalidRuleCount()) + " nieprawidłowych reguł.");
+    }
+    m_log("[✓] Wczytano " + std::to_string(rules->actionCount()) + " akcji dla " + std::to_string(rules->keyCount())
+          + " reguł" + (info.used_image ? " z obrazu '" + paths.image + "'." : "."));
+    return rules;
+}
+
+void UsbEngine::updateFilter(const RuleTable& rules) {
+    if (m_filterFd < 0) {
+        return;
+    }
+    UeventFilter filter;
+    std::string reason;
+    if (!filter.compile(rules, &reason)) {
+        m_log("[•] Bez filtra gniazda: " + reason + ".");
+        relaxFilter();
+        return;
+    }
+    std::string error;
+    if (!filter.attach(m_filterFd, &error)) {
+        m_log("[!] Nie można założyć filtra gniazda: " + error + ".");
+        relaxFilter();
+        return;
+    }
+    m_log("[•] Filtr gniazda: " + std::to_string(filter.patternCount()) + " wzorców VID:PID, "
+          + std::to_string(filter.size()) + " instrukcji, okno " + std::to_string(filter.window()) + " B.");
+}
+
+// Back to what the socket would get without our filter: libudev's own
+// subsystem filter, or every kernel uevent.
+void UsbEngine::relaxFilter() {
+    if (m_filterMonitor) {
+        udev_monitor_filter_update(m_filterMonitor);
+    } else if (m_filterFd >= 0) {
+        UeventFilter::detach(m_filterFd);
+    }
+}
+
+void UsbEngine::requestReload() {
+    {
+        std::lock_guard<std::mutex> lock(m_reloadMutex);
+        m_reloadRequested = true;
+    }
+    m_reloadWake.notify_one();
+}
+
+// Compiles on this thread; a burst of change notifications makes one rebuild.
+// Snapshots retired by a publish are released from here too, once the event
+// thread has moved past them.
+void UsbEngine::reloadLoop(const Paths& paths, std::shared_ptr<const RuleTable> live) {
+    std::unique_lock<std::mutex> lock(m_reloadMutex);
+    size_t retired = 0;
+    for (;;) {
+        auto woken = [this] { return m_reloadRequested || m_reloadStop; };
+        if (retired > 0) {
+            m_reloadWake.wait_for(lock, std::chrono::milliseconds(50), woken);
+            retired = m_rules.reclaim();
+        } else {
+            m_reloadWake.wait(lock, woken);
+        }
+        if (m_reloadStop) {
+            return;
+        }
+        if (!m_reloadRequested) {
+            continue;
+        }
+        m_reloadRequested = false;
+        lock.unlock();
+
+        std::shared_ptr<const RuleTable> rules = loadRules(paths, nullptr);
+        if (rules) {
+            RuleDiff diff = RuleTable::diff(*live, *rules);
+            if (diff.empty()) {
+                m_log("[•] Reguły bez zmian, zostaje bieżąca tabela.");
+                rules.reset();
+            } else {
+                m_log("[✓] Przeładowano reguły: " + std::to_string(diff.kept) + " bez zmian, "
+                      + std::to_string(diff.added) + " nowych lub zmienionych, " + std::to_string(diff.removed)
+                      + " usuniętych lub zmienionych.");
+                live = rules;
+            }
+        }
+
+        if (rules) {
+            // The old filter would drop events of new rules until the swap.
+            relaxFilter();
+            m_rules.publish(rules);
+            updateFilter(*rules);
+            m_dispatcher.setCurrentRules(std::move(rules));
+            retired = m_rules.reclaim();
+        }
+        lock.lock();
+    }
+}
+
+void UsbEngine::processDevice(uint32_t key, const char* devpath, DeviceAttrs& attrs,
+                              const std::shared_ptr<const RuleTable>& rules) {
+    char vidPid[10];
+    formatUsbKey(key, vidPid);
+
+    std::string deviceName;
+    if (!m_names.find(key, deviceName)) {
+        deviceName = attrs.displayName();
+        m_names.insert(key, deviceName);
+    }
+    if (deviceName.empty()) {
+        deviceName = "nieznane urządzenie";
+    }
+    const char* port = findPortPath(devpath);
+    m_log("[•] Sprawdzanie: " + deviceName + " (" + vidPid + ", port " + (port ? port : "?") + ")");
+
+    RuleMatches matches;
+    rules->match(key, devpath, matches);
+    if (matches.empty()) {
+        m_log(std::string("  [•] Brak akcji dla ") + vidPid + ".");
+        return;
+    }
+    m_log("  [•] Znaleziono " + std::to_string(matches.size()) + " reguł dla VID:PID " + vidPid + ".");
+
+    ActionSelection selected;
+    for (const RuleMatch& match : matches) {
+        rules->select(match, attrs, selected);
+        m_log("  [•] Reguła " + std::string(rules->string(match.pattern)) + ": " + std::to_string(selected.size())
+              + " z " + std::to_string(match.actions.size()) + " akcji spełnia warunki.");
+        for (const CompiledAction* action : selected) {
+            m_dispatcher.run(rules, match, *action, devpath);
+        }
+    }
+    // A serial a condition had to read is kept for the registry.
+    if (attrs.fetchedMask() & (1u << unsigned(DeviceAttr::Serial))) {
+        const char* serial = attrs.get(DeviceAttr::Serial);
+        if (serial && *serial) {
+            m_devices.change(devpath, 0, serial);
+        }
+    }
+}
+
+void UsbEngine::processUdevDevice(struct udev_device* dev, const std::shared_ptr<const RuleTable>& rules) {
+    if (!isUsbDevice(dev)) {
+        return;
+    }
+    uint32_t key;
+    if (!udevDeviceKey(dev, key)) {
+        return;
+    }
+    UdevDeviceAttrs attrs(dev);
+    processDevice(key, udev_device_get_devpath(dev), attrs, rules);
+}
+
+// VID:PID comes from PRODUCT=, so a device no rule is interested in costs
+// no sysfs access once its name is cached.
+void UsbEngine::processUevent(const Uevent& event, const std::shared_ptr<const RuleTable>& rules) {
+    uint32_t key;
+    if (!event.isUsbDevice() || !parseUeventProduct(event.product, key)) {
+        return;
+    }
+    UeventDeviceAttrs attrs(event);
+    processDevice(key, event.devpath.data(), attrs, rules);
+}
+
+bool UsbEngine::scanExisting(const ScanProgress& progress) {
+    m_log("[•] Skanowanie istniejących urządzeń USB...");
+    std::shared_ptr<const RuleTable> rules = loadRules(paths(), std::make_shared<RuleTable>());
+    std::vector<uint16_t> vendors;
+    bool narrowed = scanVendors(*rules, vendors);
+
+    size_t done = 0;
+    size_t total = 0;
+    bool cancelled = false;
+    auto step = [&] {
+        cancelled = progress && !progress(done, total);
+        return !cancelled;
+    };
+
+    if (m_sysfsScan) {
+        SysfsUsbScan scan;
+        std::string error;
+        if (!scan.run(SysfsUsbScan::kDefaultThreads, &error)) {
+            m_log("[!] Nie można odczytać listy urządzeń z sysfs: " + error);
+            return false;
+        }
+        std::vector<const Uevent*> devices;
+        for (size_t i = 0; i < scan.size(); ++i) {
+            uint32_t key;
+            if (!narrowed || (parseUeventProduct(scan[i].product, key)
+                              && std::binary_search(vendors.begin(), vendors.end(), usbKeyVid(key)))) {
+                devices.push_back(&scan[i]);
+            }
+        }
+        total = devices.size();
+        for (bool more = step(); more && done < total; more = step()) {
+            processUevent(*devices[done++], rules);
+        }
+    } else {
+        struct udev* udev = udev_new();
+        if (!udev) {
+            m_log("[!] Nie można utworzyć kontekstu udev do skanowania.");
+            return false;
+        }
+        std::vector<std::string> syspaths;
+        bool listed = true;
+        if (narrowed) {
+            for (uint16_t vendor : vendors) {
+                listed = listed && listUsbDevices(udev, vendor, syspaths);
+            }
+        } else {
+            listed = listUsbDevices(udev, -1, syspaths);
+        }
+        if (!listed) {
+            m_log("[!] Nie można utworzyć enumeratora udev.");
+            udev_unref(udev);
+            return false;
+        }
+        total = syspaths.size();
+        for (bool more = step(); more && done < total; more = step()) {
+            struct udev_device* dev = udev_device_new_from_syspath(udev, syspaths[done++].c_str());
+            if (dev) {
+                processUdevDevice(dev, rules);
+                udev_device_unref(dev);
+            }
+        }
+        udev_unref(udev);
+    }
+
+    if (cancelled && done < total) {
+        m_log("[!] Przerwano skanowanie po " + std::to_string(done) + " z " + std::to_string(total) + " urządzeń.");
+        return false;
+    }
+    m_log("[✓] Zakończono skanowanie istniejących urządzeń (" + std::to_string(total) + ").");
+    return true;
+}
+
+// With cold-plug, an "add" the startup enumeration already processed:
+// either emitted before it began, so what it found reflects the event, or
+// of the same instance (the registry refused it as known).
+bool UsbEngine::seenAtStart(uint64_t seqnum, bool newInstance) const {
+    return m_coldplugRun && ((seqnum != 0 && seqnum <= m_startSeqnum) || !newInstance);
+}
+
+// After an overflow: whatever is plugged in now but wasn't known (or came
+// back under a new device number) had its "add" lost and is processed now.
+void UsbEngine::resync(struct udev* udev, const std::shared_ptr<const RuleTable>& rules) {
+    uint64_t overflows = m_overflows.fetch_add(1, std::memory_order_relaxed) + 1;
+    m_log("[!] Przepełnienie bufora zdarzeń (" + std::to_string(overflows)
+          + "), ponowna synchronizacja urządzeń.");
+
+    std::vector<AttachedDevice> present;
+    size_t missed = 0;
+    auto check = [&](AttachedDevice device, auto process) {
+        present.push_back(device);
+        if (m_devices.add(std::move(device))) {
+            ++missed;
+            process();
+        }
+    };
+    bool ok;
+    if (m_sysfsScan) {
+        SysfsUsbScan scan;
+        ok = scan.run();
+        for (size_t i = 0; ok && i < scan.size(); ++i) {
+            check(ueventAttachedDevice(scan[i]), [&] { processUevent(scan[i], rules); });
+        }
+    } else {
+        ok = forEachUsbDevice(udev, [&](struct udev_device* dev) {
+            if (udev_device_get_devpath(dev) && isUsbDevice(dev)) {
+                check(udevAttachedDevice(dev), [&] { processUdevDevice(dev, rules); });
+            }
+        });
+    }
+    if (!ok) {
+        m_log("[!] Nie można wyliczyć urządzeń, resynchronizacja pominięta.");
+        return;
+    }
+    size_t gone = m_devices.replace(std::move(present));
+    m_log("[•] Resynchronizacja: " + std::to_string(missed) + " pominiętych podłączeń, " + std::to_string(gone)
+          + " odłączonych.");
+}
+
+// Each wakeup drains the socket until EAGAIN and matches the whole batch
+// against one snapshot. The thread is online only while it handles one, so
+// the reloader never waits for an idle bus.
+void UsbEngine::drainUdev(struct udev_monitor* mon, struct udev* udev, RcuCell<RuleTable>::Reader& reader) {
+    struct udev_device* batch[kMaxBatch];
+    size_t count = 0;
+    size_t misses = 0;
+    bool overflow = false;
+    while (count < kMaxBatch) {
+        errno = 0;
+        struct udev_device* dev = udev_monitor_receive_device(mon);
+        if (dev) {
+            batch[count++] = dev;
+        } else if (errno == ENOBUFS) {
+            // The kernel dropped messages; what is still queued is valid.
+            overflow = true;
+        } else if (errno == EAGAIN || errno == EWOULDBLOCK || ++misses > kMaxBatch) {
+            break;
+        }
+    }
+    m_batchSizes.record(count);
+    if (count == 0 && !overflow) {
+        return;
+    }
+
+    reader.online();
+    const std::shared_ptr<const RuleTable>& rules = reader.read();
+    for (size_t i = 0; i < count; ++i) {
+        struct udev_device* dev = batch[i];
+        const char* action = udev_device_get_action(dev);
+        const char* devpath = udev_device_get_devpath(dev);
+        if (action && devpath && isUsbDevice(dev)) {
+            if (strcmp(action, "add") == 0) {
+                bool added = m_devices.add(udevAttachedDevice(dev));
+                if (!seenAtStart(udev_device_get_seqnum(dev), added)) {
+                    processUdevDevice(dev, rules);
+                }
+            } else if (strcmp(action, "remove") == 0) {
+                m_devices.remove(devpath, udev_device_get_devnum(dev));
+                m_dispatcher.endStrand(devpath);
+            } else if (strcmp(action, "change") == 0) {
+                const char* serial = udev_device_get_property_value(dev, "ID_SERIAL_SHORT");
+                m_devices.change(devpath, udev_device_get_seqnum(dev), serial ? serial : "");
+            }
+        }
+        udev_device_unref(dev);
+    }
+    if (overflow) {
+        resync(udev, rules);
+    }
+    reader.offline();
+}
+
+// Same as drainUdev, in chunks of one recvmmsg. The kernel multicasts every
+// subsystem, so most messages are dropped on the subsystem/devtype check.
+void UsbEngine::drainKernel(UeventSource& source, struct udev* udev, RcuCell<RuleTable>::Reader& reader) {
+    Uevent events[UeventSource::kBatch];
+    size_t total = 0;
+    bool overflow = false;
+    while (total < kMaxBatch) {
+        size_t count = source.receive(events, overflow);
+        if (count == 0) {
+            break;
+        }
+        total += count;
+
+        reader.online();
+        const std::shared_ptr<const RuleTable>& rules = reader.read();
+        for (size_t i = 0; i < count; ++i) {
+            const Uevent& event = events[i];
+            if (!event.isUsbDevice()) {
+                continue;
+            }
+            if (event.action == "add") {
+                bool added = m_devices.add(ueventAttachedDevice(event));
+                if (!seenAtStart(event.seqnum, added)) {
+                    processUevent(event, rules);
+                }
+            } else if (event.action == "remove") {
+                m_devices.remove(std::string(event.devpath), event.devnum());
+                m_dispatcher.endStrand(event.devpath);
+            } else if (event.action == "change") {
+                m_devices.change(std::string(event.devpath), event.seqnum, std::string());
+            }
+        }
+        reader.offline();
+    }
+    m_batchSizes.record(total);
+    if (overflow) {
+        reader.online();
+        resync(udev, reader.read());
+        reader.offline();
+    }
+}
+
+bool UsbEngine::run() {
+    const Paths current = paths();
+    const Source source = m_source.load();
+    m_log("[•] Uruchomiono monitoring zdarzeń USB z '" + current.config + "'"
+          + (source == Kernel ? " (zdarzenia jądra, bez udevd)." : "."));
+    if (!m_reactor.isValid()) {
+        m_log("[!] Nie można utworzyć pętli zdarzeń (epoll).");
+        return false;
+    }
+
+    // Needed by both sources: enumeration for the initial device list and
+    // for resync reads sysfs and works without udevd.
+    struct udev* udev = udev_new();
+    if (!udev) {
+        m_log("[!] Nie można utworzyć kontekstu udev.");
+        return false;
+    }
+
+    int receiveBuffer = m_receiveBuffer.load();
+    struct udev_monitor* mon = nullptr;
+    UeventSource kernel;
+    int fd = -1;
+    if (source == Kernel) {
+        std::string error;
+        if (!kernel.open(receiveBuffer, &error)) {
+            m_log("[!] Nie można otworzyć gniazda zdarzeń jądra: " + error);
+            udev_unref(udev);
+            return false;
+        }
+        fd = kernel.fd();
+    } else {
+        mon = udev_monitor_new_from_netlink(udev, "udev");
+        if (!mon) {
+            m_log("[!] Nie można utworzyć monitora udev.");
+            udev_unref(udev);
+            return false;
+        }
+        udev_monitor_filter_add_match_subsystem_devtype(mon, UeventFilter::kUdevSubsystem, UeventFilter::kUdevDevtype);
+        if (receiveBuffer > 0 && udev_monitor_set_receive_buffer_size(mon, receiveBuffer) < 0) {
+            m_log("[!] Nie można ustawić bufora odbiorczego " + std::to_string(receiveBuffer) + " B.");
+        }
+        udev_monitor_enable_receiving(mon);
+        fd = udev_monitor_get_fd(mon);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    }
+
+    ConfigWatcher watcher(current.config);
+    if (!watcher.isValid()) {
+        m_log("[!] Brak inotify - zmiany '" + current.config + "' nie będą wczytywane automatycznie.");
+    }
+    watcher.addFile(current.image);
+    std::shared_ptr<const RuleTable> initial = loadRules(current, std::make_shared<RuleTable>());
+    m_rules.publish(initial);
+    if (m_socketFilter) {
+        m_filterFd = fd;
+        m_filterMonitor = mon;
+        updateFilter(*initial);
+    }
+    m_dispatcher.setCurrentRules(initial);
+    m_reloadStop = false;
+    m_reloadRequested = false;
+    std::thread reloader(&UsbEngine::reloadLoop, this, current, initial);
+
+    RcuCell<RuleTable>::Reader reader(m_rules);
+    reader.offline();
+
+    // Devices present before the first event; the socket is already
+    // receiving and buffers whatever happens meanwhile, so nothing falls in
+    // between. With cold-plug they are processed as "add" here, and the
+    // buffered events are merged in by the drains: those up to the SEQNUM
+    // read before enumerating are dropped, later ones by devpath/devnum.
+    m_devices.clear();
+    const bool coldplug = m_coldplug;
+    m_coldplugRun = coldplug;
+    m_startSeqnum = coldplug ? currentUeventSeqnum() : 0;
+    size_t present = 0;
+    if (m_sysfsScan) {
+        SysfsUsbScan scan;
+        scan.run();
+        for (size_t i = 0; i < scan.size(); ++i) {
+            m_devices.add(ueventAttachedDevice(scan[i]));
+            if (coldplug) {
+                processUevent(scan[i], initial);
+            }
+        }
+        present = scan.size();
+    } else {
+        forEachUsbDevice(udev, [&](struct udev_device* dev) {
+            if (isUsbDevice(dev)) {
+                m_devices.add(udevAttachedDevice(dev));
+                if (coldplug) {
+                    processUdevDevice(dev, initial);
+                }
+                ++present;
+            }
+        });
+    }
+    if (coldplug) {
+        m_log("[✓] Sprawdzono " + std::to_string(present) + " podłączonych urządzeń przed startem (SEQNUM "
+              + std::to_string(m_startSeqnum) + ").");
+    }
+    initial.reset();
+
+    m_dispatcher.attach(m_reactor);
+    if (mon) {
+        m_reactor.add(fd, EPOLLIN, [&](uint32_t) { drainUdev(mon, udev, reader); });
+    } else {
+        m_reactor.add(fd, EPOLLIN, [&](uint32_t) { drainKernel(kernel, udev, reader); });
+    }
+    if (watcher.isValid()) {
+        m_reactor.add(watcher.fd(), EPOLLIN, [&](uint32_t) {
+            if (watcher.consumeChanges()) {
+                m_log("[•] Zmiana pliku konfiguracji, przebudowa reguł w tle.");
+                requestReload();
+            }
+        });
+    }
+
+    bool ok = m_reactor.run();
+    if (!ok) {
+        m_log("[!] Błąd pętli zdarzeń: " + std::string(strerror(errno)));
+    }
+    m_reactor.remove(fd);
+    m_reactor.remove(watcher.fd());
+    m_dispatcher.detach(m_reactor);
+
+    {
+        std::lock_guard<std::mutex> lock(m_reloadMutex);
+        m_reloadStop = true;
+    }
+    m_reloadWake.notify_one();
+    reloader.join();
+    // A later scan compiles its own table; don't judge its actions by this one.
+    m_dispatcher.setCurrentRules(nullptr);
+    m_filterFd = -1;
+    m_filterMonitor = nullptr;
+    // Nothing keeps it current any more.
+    m_devices.clear();
+
+    if (mon) {
+        udev_monitor_unref(mon);
+    }
+    udev_unref(udev);
+    m_log("[•] Rozmiary paczek zdarzeń: " + m_batchSizes.format() + ", przepełnienia bufora: "
+          + std::to_string(overflowCount()));
+    m_log("[✓] Zatrzymano monitoring.");
+    return ok;
+}
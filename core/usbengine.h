@@ -0,0 +1,163 @@
+#ifndef USBENGINE_H
+#define USBENGINE_H
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <sys/types.h>
+#include <vector>
+#include "deviceattrs.h"
+#include "deviceregistry.h"
+#include "dispatcher.h"
+#include "histogram.h"
+#include "logsink.h"
+#include "namecache.h"
+#include "rcucell.h"
+#include "reactor.h"
+#include "ruletable.h"
+
+struct udev;
+struct udev_device;
+struct udev_monitor;
+struct Uevent;
+class UeventSource;
+
+// The monitoring loop shared by the GUI and the CLI daemon: udev "add"
+// events, config reload on change, rule matching and action dispatch.
+// Qt-free; everything user-visible goes through the LogSink.
+//
+// Reloads are compiled on a separate thread while events keep flowing and
+// published through an RcuCell, so the event thread reads the live table
+// without taking a lock. A reload that changes no rule is discarded,
+// otherwise delayed actions of unchanged rules carry on.
+//
+// While run() is active the engine keeps a DeviceRegistry of what is
+// plugged in. If the uevent socket overflows (ENOBUFS), it re-enumerates
+// and diffs against the registry, so a lost "add" still triggers.
+//
+// A classic BPF filter built from the rule patterns is attached to the
+// event socket, so devices no rule can match don't wake the loop; it is
+// rebuilt on every reload.
+//
+// Events come from udevd by default. The Kernel source reads the kernel's
+// own uevents instead: it works without udevd and skips its latency, and
+// VID:PID is taken from the message rather than from sysfs.
+class UsbEngine {
+public:
+    static const int kDefaultReceiveBuffer = 4 << 20;
+
+    enum Source {
+        Udev,
+        Kernel
+    };
+
+    UsbEngine(ActionDispatcher::Mode mode, LogSink log);
+
+    // imagePath defaults to RuleImage::defaultPathFor(configPath). Takes
+    // effect on the next run() or scanExisting().
+    void setConfigPath(const std::string& configPath, const std::string& imagePath = std::string());
+
+    // Blocks until stop(). Returns false if udev monitoring can't be set up.
+    bool run();
+    // Any thread; run() returns without waiting for another event.
+    void stop();
+    void resetStop();
+
+    // The loop run() dispatches from, for extra sources (signals, timers,
+    // control sockets). Their handlers run on the monitoring thread.
+    Reactor& reactor() { return m_reactor; }
+
+    // Receive buffer of the uevent socket in bytes, 0 for the system
+    // default. Takes effect on the next run().
+    void setReceiveBufferSize(int bytes);
+    // Takes effect on the next run().
+    void setSource(Source source);
+    // Kernel-side filtering of the event socket, on by default. Takes
+    // effect on the next run().
+    void setSocketFilter(bool enabled);
+    // Lists plugged-in devices by walking sysfs (SysfsUsbScan) instead of
+    // libudev enumeration: for scanExisting(), the initial device list and
+    // resync. Off by default; pays off with thousands of devices.
+    void setSysfsScan(bool enabled);
+    // Processes the devices already plugged in as "add" when run() starts,
+    // merged with the live events so each fires once and none is missed.
+    // Off by default. Takes effect on the next run().
+    void setColdplug(bool enabled);
+    // Scripts running at once over all rules, 0 for no limit; see
+    // ActionDispatcher. Any thread.
+    void setMaxConcurrent(size_t limit);
+    // Actions are started through spawner instead of forking this process;
+    // see ActionDispatcher. Before run() or scanExisting().
+    void setSpawner(Spawner* spawner);
+
+    // Devices plugged in while run() is active, empty otherwise. Set its
+    // listener before run().
+    DeviceRegistry& devices() { return m_devices; }
+    const DeviceRegistry& devices() const { return m_devices; }
+
+    // Uevents received per wakeup, since the engine was created.
+    const BatchHistogram& batchSizes() const { return m_batchSizes; }
+    // Overflows of the uevent socket, since the engine was created.
+    uint64_t overflowCount() const { return m_overflows.load(std::memory_order_relaxed); }
+
+    // Called after each device of a scan with the devices done so far and
+    // the total; returning false cancels the scan.
+    using ScanProgress = std::function<bool(size_t done, size_t total)>;
+
+    // One pass over the devices that are already plugged in. Only usb_device
+    // entries are enumerated, and only those of the configured vendors when
+    // no rule accepts any VID. Safe to call while run() is active on another
+    // thread. Returns false if the scan was cancelled or udev failed.
+    bool scanExisting(const ScanProgress& progress = ScanProgress());
+
+private:
+    struct Paths {
+        std::string config;
+        std::string image;
+    };
+
+    Paths paths();
+    std::shared_ptr<const RuleTable> loadRules(const Paths& paths, std::shared_ptr<const RuleTable> fallback);
+    void processDevice(uint32_t key, const char* devpath, DeviceAttrs& attrs,
+                       const std::shared_ptr<const RuleTable>& rules);
+    void processUdevDevice(struct udev_device* dev, const std::shared_ptr<const RuleTable>& rules);
+    void processUevent(const Uevent& event, const std::shared_ptr<const RuleTable>& rules);
+    bool seenAtStart(uint64_t seqnum, bool newInstance) const;
+    void drainUdev(struct udev_monitor* mon, struct udev* udev, RcuCell<RuleTable>::Reader& reader);
+    void drainKernel(UeventSource& source, struct udev* udev, RcuCell<RuleTable>::Reader& reader);
+    void resync(struct udev* udev, const std::shared_ptr<const RuleTable>& rules);
+    void updateFilter(const RuleTable& rules);
+    void relaxFilter();
+    void reloadLoop(const Paths& paths, std::shared_ptr<const RuleTable> live);
+    void requestReload();
+
+    LogSink m_log;
+    ActionDispatcher m_dispatcher;
+    std::mutex m_pathMutex;
+    Paths m_paths;
+    Reactor m_reactor;
+    RcuCell<RuleTable> m_rules;
+    BatchHistogram m_batchSizes;
+    std::atomic<int> m_receiveBuffer;
+    std::atomic<Source> m_source;
+    std::atomic<bool> m_socketFilter;
+    std::atomic<bool> m_sysfsScan;
+    std::atomic<bool> m_coldplug;
+    int m_filterFd = -1;            // set while run() is active
+    struct udev_monitor* m_filterMonitor = nullptr;
+    std::atomic<uint64_t> m_overflows;
+    DeviceRegistry m_devices;
+    bool m_coldplugRun = false;     // event thread only, with m_startSeqnum
+    uint64_t m_startSeqnum = 0;
+    NameCache m_names;
+
+    std::mutex m_reloadMutex;       // never held while compiling
+    std::condition_variable m_reloadWake;
+    bool m_reloadRequested = false;
+    bool m_reloadStop = false;
+};
+
+#endif // USBENGINE_H
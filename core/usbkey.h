@@ -0,0 +1,172 @@
+#ifndef USBKEY_H
+#define USBKEY_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+// VID:PID packed into one integer: vendor in the high half, product in the low half.
+inline uint32_t makeUsbKey(uint16_t vid, uint16_t pid) {
+    return (uint32_t(vid) << 16) | pid;
+}
+
+inline uint16_t usbKeyVid(uint32_t key) { return uint16_t(key >> 16); }
+inline uint16_t usbKeyPid(uint32_t key) { return uint16_t(key & 0xffff); }
+
+inline int hexDigitValue(char c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+// Parses 1..4 hex digits in [begin, end), e.g. sysattr idVendor "0781".
+inline bool parseUsbId(const char* begin, const char* end, uint16_t& out) {
+    if (begin == end || end - begin > 4) {
+        return false;
+    }
+    uint32_t value = 0;
+    for (const char* p = begin; p != end; ++p) {
+        int d = hexDigitValue(*p);
+        if (d < 0) {
+            return false;
+        }
+        value = (value << 4) | uint32_t(d);
+    }
+    out = uint16_t(value);
+    return true;
+}
+
+inline bool parseUsbId(const char* str, uint16_t& out) {
+    if (!str) {
+        return false;
+    }
+    const char* end = str;
+    while (*end && end - str <= 4) {
+        ++end;
+    }
+    return parseUsbId(str, end, out);
+}
+
+// Parses "vvvv:pppp" into a packed key.
+inline bool parseUsbKey(const std::string& text, uint32_t& key) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    uint16_t vid, pid;
+    const char* s = text.c_str();
+    if (!parseUsbId(s, s + colon, vid) || !parseUsbId(s + colon + 1, s + text.size(), pid)) {
+        return false;
+    }
+    key = makeUsbKey(vid, pid);
+    return true;
+}
+
+// Key pattern from triggers.json. The VID is exact or "*"; the PID part is
+// exact ("5567"), "*", a range ("5500-55ff") or a value/mask pair ("5500/ff00").
+struct UsbPattern {
+    enum Kind { Exact, Range, Mask };
+
+    Kind kind = Exact;
+    bool any_vid = false;
+    uint16_t vid = 0;
+    uint16_t lo = 0;       // Exact / Range
+    uint16_t hi = 0;
+    uint16_t value = 0;    // Mask
+    uint16_t mask = 0;
+
+    // Number of PIDs the pattern covers; used to order matches by specificity.
+    uint32_t span() const {
+        if (kind == Mask) {
+            uint32_t free = 1;
+            for (uint16_t m = uint16_t(~mask); m; m &= uint16_t(m - 1)) {
+                free <<= 1;
+            }
+            return free;
+        }
+        return uint32_t(hi) - lo + 1;
+    }
+};
+
+inline bool parseUsbPattern(const std::string& text, UsbPattern& out) {
+    size_t colon = text.find(':');
+    if (colon == std::string::npos) {
+        return false;
+    }
+    const char* s = text.c_str();
+    const char* end = s + text.size();
+    UsbPattern p;
+
+    if (colon == 1 && s[0] == '*') {
+        p.any_vid = true;
+    } else if (!parseUsbId(s, s + colon, p.vid)) {
+        return false;
+    }
+
+    const char* pid = s + colon + 1;
+    if (end - pid == 1 && *pid == '*') {
+        p.kind = UsbPattern::Range;
+        p.lo = 0;
+        p.hi = 0xffff;
+    } else if (const char* dash = static_cast<const char*>(memchr(pid, '-', size_t(end - pid)))) {
+        p.kind = UsbPattern::Range;
+        if (!parseUsbId(pid, dash, p.lo) || !parseUsbId(dash + 1, end, p.hi) || p.lo > p.hi) {
+            return false;
+        }
+    } else if (const char* slash = static_cast<const char*>(memchr(pid, '/', size_t(end - pid)))) {
+        p.kind = UsbPattern::Mask;
+        if (!parseUsbId(pid, slash, p.value) || !parseUsbId(slash + 1, end, p.mask)) {
+            return false;
+        }
+        p.value &= p.mask;
+        // A mask that only frees low bits is just a range.
+        uint16_t free = uint16_t(~p.mask);
+        if ((free & uint16_t(free + 1)) == 0) {
+            p.kind = UsbPattern::Range;
+            p.lo = p.value;
+            p.hi = uint16_t(p.value | free);
+        }
+    } else {
+        if (!parseUsbId(pid, end, p.lo)) {
+            return false;
+        }
+        p.hi = p.lo;
+    }
+    // A single PID goes to the exact table only when the VID is fixed too.
+    if (p.kind != UsbPattern::Mask) {
+        p.kind = (p.lo == p.hi && !p.any_vid) ? UsbPattern::Exact : UsbPattern::Range;
+    }
+    out = p;
+    return true;
+}
+
+// Canonical text of a pattern, so "0781:55AA" and "0781:55aa" share one group.
+inline std::string formatUsbPattern(const UsbPattern& p) {
+    char buf[32];
+    char vid[8];
+    if (p.any_vid) {
+        std::snprintf(vid, sizeof(vid), "*");
+    } else {
+        std::snprintf(vid, sizeof(vid), "%04x", p.vid);
+    }
+    if (p.kind == UsbPattern::Mask) {
+        std::snprintf(buf, sizeof(buf), "%s:%04x/%04x", vid, p.value, p.mask);
+    } else if (p.kind == UsbPattern::Range && p.lo == 0 && p.hi == 0xffff) {
+        std::snprintf(buf, sizeof(buf), "%s:*", vid);
+    } else if (p.lo == p.hi) {
+        std::snprintf(buf, sizeof(buf), "%s:%04x", vid, p.lo);
+    } else {
+        std::snprintf(buf, sizeof(buf), "%s:%04x-%04x", vid, p.lo, p.hi);
+    }
+    return buf;
+}
+
+// Formats a key as "vvvv:pppp" into a caller-provided buffer (no allocation).
+inline const char* formatUsbKey(uint32_t key, char (&buf)[10]) {
+    std::snprintf(buf, sizeof(buf), "%04x:%04x", usbKeyVid(key), usbKeyPid(key));
+    return buf;
+}
+
+#endif // USBKEY_H
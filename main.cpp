@@ -1,9 +1,22 @@
 #include <QApplication>
+#include <memory>
+#include <string>
+#include "core/spawner.h"
 #include "mainwindow.h"
 
 int main(int argc, char *argv[]) {
+    // Forked while the process is still small and single-threaded, so
+    // actions don't have to fork the whole GUI.
+    std::string spawnerError;
+    std::unique_ptr<Spawner> spawner = Spawner::start(&spawnerError);
+
     QApplication a(argc, argv);
+    if (!spawner) {
+        qWarning("Nie można uruchomić procesu pomocniczego (%s), akcje będą uruchamiane bezpośrednio.",
+                 spawnerError.c_str());
+    }
     MainWindow w;
+    w.setSpawner(spawner.get());
     w.show();
     return a.exec();
 }
@@ -12,6 +12,9 @@
 #include <QFileDialog>
 #include <QSettings>
 #include <QModelIndex>
+#include <QDateTime>
+#include <algorithm>
+#include "core/portpath.h"
 
 MainWindow::MainWindow(QWidget *parent)
     : QMainWindow(parent),
@@ -26,6 +29,9 @@ MainWindow::MainWindow(QWidget *parent)
 
     connect(m_usbMonitor, &UsbMonitor::logMessage, this, &MainWindow::updateLog);
     connect(m_usbMonitor, &UsbMonitor::logMessage, this, &MainWindow::updateStatusBar);
+    connect(m_usbMonitor, &UsbMonitor::scanProgress, this, &MainWindow::onScanProgress);
+    connect(m_usbMonitor, &UsbMonitor::scanFinished, this, &MainWindow::onScanFinished);
+    connect(m_usbMonitor, &UsbMonitor::devicesChanged, this, &MainWindow::onDevicesChanged);
     
     connect(m_usbMonitor, &UsbMonitor::started, this, [this](){
         m_startMonitorButton->setEnabled(false);
@@ -49,6 +55,10 @@ MainWindow::~MainWindow() {
     delete m_triggerModel;
 }
 
+void MainWindow::setSpawner(Spawner* spawner) {
+    m_usbMonitor->setSpawner(spawner);
+}
+
 void MainWindow::setupUi() {
     setWindowTitle("autotriggers");
 
@@ -60,10 +70,13 @@ void MainWindow::setupUi() {
     m_startMonitorButton = new QPushButton("Start", this);
     m_stopMonitorButton = new QPushButton("Stop", this);
     m_stopMonitorButton->setEnabled(false);
-    QPushButton *checkExistingButton = new QPushButton("Sprawdź istniejące", this);
+    m_checkExistingButton = new QPushButton("Sprawdź istniejące", this);
+    m_coldplugCheck = new QCheckBox("Start z istniejącymi", this);
+    m_coldplugCheck->setToolTip("Przy starcie monitoringu obsłuż też urządzenia już podłączone, każde dokładnie raz.");
     controlLayout->addWidget(m_startMonitorButton);
     controlLayout->addWidget(m_stopMonitorButton);
-    controlLayout->addWidget(checkExistingButton);
+    controlLayout->addWidget(m_checkExistingButton);
+    controlLayout->addWidget(m_coldplugCheck);
     m_controlsDock->setWidget(controlsWidget);
 
     m_autotriggerDock = new QDockWidget("autotrigger", this);
@@ -87,9 +100,20 @@ void MainWindow::setupUi() {
     m_logOutput->setReadOnly(true);
     m_logDock->setWidget(m_logOutput);
 
+    m_devicesDock = new QDockWidget("Podłączone urządzenia", this);
+    m_devicesDock->setFeatures(QDockWidget::DockWidgetClosable | QDockWidget::DockWidgetMovable | QDockWidget::DockWidgetFloatable);
+    m_devicesTable = new QTableWidget(0, 5, this);
+    m_devicesTable->setHorizontalHeaderLabels({"VID:PID", "Port", "Numer seryjny", "SEQNUM", "Podłączono"});
+    m_devicesTable->horizontalHeader()->setSectionResizeMode(QHeaderView::Stretch);
+    m_devicesTable->setSelectionBehavior(QAbstractItemView::SelectRows);
+    m_devicesTable->setEditTriggers(QAbstractItemView::NoEditTriggers);
+    m_devicesDock->setWidget(m_devicesTable);
+
     addDockWidget(Qt::RightDockWidgetArea, m_controlsDock);
     splitDockWidget(m_controlsDock, m_autotriggerDock, Qt::Vertical);
     splitDockWidget(m_autotriggerDock, m_logDock, Qt::Vertical);
+    tabifyDockWidget(m_autotriggerDock, m_devicesDock);
+    m_autotriggerDock->raise();
     
     setCentralWidget(nullptr);
 
@@ -99,13 +123,13 @@ void MainWindow::setupUi() {
     connect(removeButton, &QPushButton::clicked, this, &MainWindow::onRemoveTriggerClicked);
     connect(m_startMonitorButton, &QPushButton::clicked, this, &MainWindow::onStartMonitoringClicked);
     connect(m_stopMonitorButton, &QPushButton::clicked, this, &MainWindow::onStopMonitoringClicked);
-    connect(checkExistingButton, &QPushButton::clicked, this, &MainWindow::onCheckExistingDevicesClicked);
+    connect(m_checkExistingButton, &QPushButton::clicked, this, &MainWindow::onCheckExistingDevicesClicked);
 }
 
 void MainWindow::createMenus() {
     QMenu *fileMenu = menuBar()->addMenu(tr("&Plik"));
     fileMenu->addAction(tr("Dodaj autotrigger..."), this, &MainWindow::onOpenAddTriggerDialog);
-    fileMenu->addAction(tr("Sprawdź istniejące..."), this, &MainWindow::onCheckExistingDevicesClicked);
+    m_checkExistingAction = fileMenu->addAction(tr("Sprawdź istniejące..."), this, &MainWindow::onCheckExistingDevicesClicked);
     fileMenu->addSeparator();
     fileMenu->addAction(tr("Otwórz konfigurację..."), this, &MainWindow::onOpenConfigClicked);
     fileMenu->addAction(tr("Zapisz konfigurację..."), this, &MainWindow::onSaveConfigClicked);
@@ -116,6 +140,7 @@ void MainWindow::createMenus() {
     viewMenu->addAction(m_autotriggerDock->toggleViewAction());
     viewMenu->addAction(m_controlsDock->toggleViewAction());
     viewMenu->addAction(m_logDock->toggleViewAction());
+    viewMenu->addAction(m_devicesDock->toggleViewAction());
 
     QMenu *helpMenu = menuBar()->addMenu(tr("&Pomoc"));
     helpMenu->addAction(tr("program..."), this, [](){
@@ -126,10 +151,10 @@ void MainWindow::createMenus() {
 void MainWindow::onOpenAddTriggerDialog() {
     AddRuleDialog dialog(this);
     if (dialog.exec() == QDialog::Accepted) {
-        TriggerRule rule = dialog.getTriggerRule();
+        ActionSpec action = dialog.getAction();
         QString vidPid = dialog.getVidPid();
-        if (!vidPid.isEmpty() && !rule.script.isEmpty()) {
-            m_triggerModel->addTrigger(vidPid, rule);
+        if (!vidPid.isEmpty() && !action.script.empty()) {
+            m_triggerModel->addTrigger(vidPid, action);
             updateLog(QString("[✓] Dodano autotrigger dla VID:PID %1").arg(vidPid));
         } else {
             QMessageBox::warning(this, "Błąd", "Nie można dodać autotriggera. Wprowadź VID:PID i ścieżkę do skryptu.");
@@ -152,6 +177,7 @@ void MainWindow::onRemoveTriggerClicked() {
 
 void MainWindow::onStartMonitoringClicked() {
     m_usbMonitor->setConfigPath(m_configPath);
+    m_usbMonitor->setColdplug(m_coldplugCheck->isChecked());
     m_usbMonitor->resetStopFlag();
     m_usbMonitor->start();
 }
@@ -161,8 +187,62 @@ void MainWindow::onStopMonitoringClicked() {
 }
 
 void MainWindow::onCheckExistingDevicesClicked() {
+    if (m_usbMonitor->isScanning()) {
+        return;
+    }
     m_usbMonitor->setConfigPath(m_configPath);
-    m_usbMonitor->checkExistingDevices();
+
+    m_scanProgress = new QProgressDialog("Skanowanie urządzeń USB...", "Anuluj", 0, 0, this);
+    m_scanProgress->setWindowModality(Qt::NonModal);
+    m_scanProgress->setMinimumDuration(500);
+    m_scanProgress->setAutoReset(false);
+    connect(m_scanProgress, &QProgressDialog::canceled, m_usbMonitor, &UsbMonitor::cancelScan);
+
+    m_checkExistingButton->setEnabled(false);
+    m_checkExistingAction->setEnabled(false);
+    m_usbMonitor->startScan();
+}
+
+void MainWindow::onScanProgress(int done, int total) {
+    if (m_scanProgress) {
+        m_scanProgress->setMaximum(total);
+        m_scanProgress->setValue(done);
+    }
+}
+
+void MainWindow::onScanFinished(bool completed) {
+    if (m_scanProgress) {
+        m_scanProgress->deleteLater();
+        m_scanProgress = nullptr;
+    }
+    m_checkExistingButton->setEnabled(true);
+    m_checkExistingAction->setEnabled(true);
+    updateStatusBar(completed ? "Skanowanie zakończone." : "Skanowanie przerwane.");
+}
+
+void MainWindow::onDevicesChanged() {
+    std::vector<AttachedDevice> devices = m_usbMonitor->attachedDevices();
+    std::sort(devices.begin(), devices.end(), [](const AttachedDevice& a, const AttachedDevice& b) {
+        return a.devpath < b.devpath;
+    });
+    m_devicesTable->setRowCount(int(devices.size()));
+    for (size_t i = 0; i < devices.size(); ++i) {
+        const AttachedDevice& device = devices[i];
+        char vidPid[10];
+        const char* port = findPortPath(device.devpath.c_str());
+        QString attached = QDateTime::fromSecsSinceEpoch(
+            std::chrono::system_clock::to_time_t(device.attached)).toString("yyyy-MM-dd HH:mm:ss");
+        const QString columns[] = {
+            device.key ? QString(formatUsbKey(device.key, vidPid)) : QString("?"),
+            port ? QString(port) : QString::fromStdString(device.devpath),
+            QString::fromStdString(device.serial),
+            device.seqnum ? QString::number(device.seqnum) : QString("-"),
+            attached,
+        };
+        for (int column = 0; column < 5; ++column) {
+            m_devicesTable->setItem(int(i), column, new QTableWidgetItem(columns[column]));
+        }
+    }
 }
 
 void MainWindow::onSaveConfigClicked() {
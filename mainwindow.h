@@ -17,10 +17,10 @@
 #include <QSplitter>
 #include <QTextEdit>
 #include <QAction>
+#include <QProgressDialog>
 #include "usbmonitor.h"
 #include "triggermodel.h"
 #include "addruledialog.h"
-#include <nlohmann/json.hpp>
 
 class MainWindow : public QMainWindow {
     Q_OBJECT
@@ -29,6 +29,9 @@ public:
     MainWindow(QWidget *parent = nullptr);
     ~MainWindow();
 
+    // Before monitoring or a scan starts.
+    void setSpawner(Spawner* spawner);
+
 private slots:
     void onOpenAddTriggerDialog();
     void onRemoveTriggerClicked();
@@ -37,6 +40,9 @@ private slots:
     void onSaveConfigClicked();
     void onOpenConfigClicked();
     void onCheckExistingDevicesClicked();
+    void onScanProgress(int done, int total);
+    void onScanFinished(bool completed);
+    void onDevicesChanged();
     void updateLog(const QString& message);
     void updateStatusBar(const QString& message);
 
@@ -51,10 +57,16 @@ private:
     QDockWidget *m_autotriggerDock;
     QDockWidget *m_controlsDock;
     QDockWidget *m_logDock;
+    QDockWidget *m_devicesDock;
 
     QPushButton *m_startMonitorButton;
     QPushButton *m_stopMonitorButton;
+    QPushButton *m_checkExistingButton;
+    QCheckBox *m_coldplugCheck;
+    QAction *m_checkExistingAction;
+    QProgressDialog *m_scanProgress = nullptr;
 
+    QTableWidget *m_devicesTable;
     QPlainTextEdit *m_logOutput;
     QStatusBar *m_statusBar;
 
@@ -1,11 +1,6 @@
 #include "triggermodel.h"
-#include <QMessageBox>
-#include <QJsonArray>
-#include <QJsonObject>
-#include <QJsonDocument>
 #include <QDebug>
-#include <QFile>
-#include <QMap>
+#include <QStringList>
 
 TriggerModel::TriggerModel(QObject* parent)
     : QAbstractTableModel(parent)
@@ -14,27 +9,46 @@ TriggerModel::TriggerModel(QObject* parent)
 
 int TriggerModel::rowCount(const QModelIndex& parent) const {
     Q_UNUSED(parent);
-    return m_triggers.size();
+    return m_rows.size();
 }
 
 int TriggerModel::columnCount(const QModelIndex& parent) const {
     Q_UNUSED(parent);
-    return 5;
+    return 7;
 }
 
 QVariant TriggerModel::data(const QModelIndex& index, int role) const {
-    if (!index.isValid() || index.row() >= m_triggers.size()) {
+    if (!index.isValid() || index.row() >= m_rows.size()) {
         return QVariant();
     }
     
     if (role == Qt::DisplayRole) {
-        const TriggerRule& rule = m_triggers.at(index.row());
+        const RuleEntry& entry = m_config.entries()[size_t(m_rows[index.row()].first)];
+        const ActionSpec& action = entry.actions[size_t(m_rows[index.row()].second)];
         switch (index.column()) {
-            case 0: return rule.vidPid;
-            case 1: return rule.script;
-            case 2: return rule.args.join(" ");
-            case 3: return rule.authRequired ? "Tak" : "Nie";
-            case 4: return rule.delaySec;
+            case 0: return QString::fromStdString(entry.key);
+            case 1: return QString::fromStdString(action.script);
+            case 2: {
+                QStringList args;
+                for (const std::string& arg : action.args) {
+                    args.append(QString::fromStdString(arg));
+                }
+                return args.join(" ");
+            }
+            case 3: return action.auth_required ? "Tak" : "Nie";
+            case 4: return action.delay_sec;
+            case 5: {
+                QStringList conditions;
+                for (const auto& [attr, value] : action.match) {
+                    conditions.append(QString("%1=%2").arg(QString::fromStdString(attr), QString::fromStdString(value)));
+                }
+                return conditions.join(" ");
+            }
+            case 6:
+                if (action.max_concurrent <= 0) {
+                    return QString();
+                }
+                return QString::number(action.max_concurrent) + (action.drop_overflow ? " (pomijaj)" : "");
         }
     }
     return QVariant();
@@ -48,107 +62,55 @@ QVariant TriggerModel::headerData(int section, Qt::Orientation orientation, int
             case 2: return "Argumenty";
             case 3: return "Auth";
             case 4: return "Opóźnienie";
+            case 5: return "Warunki";
+            case 6: return "Limit";
         }
     }
     return QVariant();
 }
 
-void TriggerModel::addTrigger(const QString& vidPid, const TriggerRule& rule) {
-    beginInsertRows(QModelIndex(), m_triggers.size(), m_triggers.size());
-    m_triggers.append(rule);
-    m_triggers.last().vidPid = vidPid;
-    endInsertRows();
-}
-
-void TriggerModel::removeTriggers(const QString& vidPid) {
-    QList<int> rowsToRemove;
-    for (int i = 0; i < m_triggers.size(); ++i) {
-        if (m_triggers.at(i).vidPid == vidPid) {
-            rowsToRemove.prepend(i);
+void TriggerModel::rebuildRows() {
+    m_rows.clear();
+    const std::vector<RuleEntry>& entries = m_config.entries();
+    for (size_t e = 0; e < entries.size(); ++e) {
+        for (size_t a = 0; a < entries[e].actions.size(); ++a) {
+            m_rows.append(qMakePair(int(e), int(a)));
         }
     }
-    
-    for (int row : rowsToRemove) {
-        beginRemoveRows(QModelIndex(), row, row);
-        m_triggers.removeAt(row);
-        endRemoveRows();
-    }
 }
 
-bool TriggerModel::loadTriggers(const QString& filePath) {
+void TriggerModel::addTrigger(const QString& vidPid, const ActionSpec& action) {
     beginResetModel();
-    m_triggers.clear();
-    
-    QFile file(filePath);
-    if (!file.open(QIODevice::ReadOnly | QIODevice::Text)) {
-        endResetModel();
-        return false;
-    }
-
-    QByteArray file_data = file.readAll();
-    file.close();
-
-    QJsonDocument doc = QJsonDocument::fromJson(file_data);
-    if (doc.isNull() || !doc.isObject()) {
-        qWarning() << "failed to create json document or not an object";
-        endResetModel();
-        return false;
-    }
+    m_config.add(vidPid.toStdString(), action);
+    rebuildRows();
+    endResetModel();
+}
 
-    QJsonObject obj = doc.object();
-    for (auto it = obj.constBegin(); it != obj.constEnd(); ++it) {
-        QString vidPid = it.key();
-        QJsonArray rules_array = it.value().toArray();
+void TriggerModel::removeTriggers(const QString& vidPid) {
+    beginResetModel();
+    m_config.remove(vidPid.toStdString());
+    rebuildRows();
+    endResetModel();
+}
 
-        for (const QJsonValue& value : rules_array) {
-            QJsonObject rule_obj = value.toObject();
-            TriggerRule rule;
-            rule.vidPid = vidPid;
-            rule.script = rule_obj["action_script"].toString();
-            rule.authRequired = rule_obj["auth_required"].toBool();
-            rule.delaySec = rule_obj["delay_sec"].toInt();
-            
-            QJsonArray args_array = rule_obj["action_args"].toArray();
-            for (const QJsonValue& arg_value : args_array) {
-                rule.args.append(arg_value.toString());
-            }
-            m_triggers.append(rule);
-        }
+bool TriggerModel::loadTriggers(const QString& filePath) {
+    beginResetModel();
+    std::string error;
+    bool ok = m_config.load(filePath.toStdString(), &error);
+    if (!ok) {
+        qWarning() << "failed to load" << filePath << ":" << QString::fromStdString(error);
+        m_config.clear();
     }
+    rebuildRows();
     endResetModel();
-    return true;
+    return ok;
 }
 
 bool TriggerModel::saveTriggers(const QString& filePath) {
-    QFile file(filePath);
-    if (!file.open(QIODevice::WriteOnly | QIODevice::Text)) {
+    std::string error;
+    if (!m_config.save(filePath.toStdString(), &error)) {
+        qWarning() << "failed to save" << filePath << ":" << QString::fromStdString(error);
         return false;
     }
-
-    QJsonObject main_obj;
-    for (const TriggerRule& rule : m_triggers) {
-        QJsonArray rules_array;
-        if (main_obj.contains(rule.vidPid)) {
-            rules_array = main_obj[rule.vidPid].toArray();
-        }
-        
-        QJsonObject rule_obj;
-        rule_obj["action_script"] = rule.script;
-        rule_obj["auth_required"] = rule.authRequired;
-        rule_obj["delay_sec"] = rule.delaySec;
-        
-        QJsonArray args_array;
-        for (const QString& arg : rule.args) {
-            args_array.append(arg);
-        }
-        rule_obj["action_args"] = args_array;
-        rules_array.append(rule_obj);
-        main_obj[rule.vidPid] = rules_array;
-    }
-
-    QJsonDocument doc(main_obj);
-    file.write(doc.toJson());
-    file.close();
-
     return true;
 }
@@ -2,21 +2,13 @@
 #define TRIGGERMODEL_H
 
 #include <QAbstractTableModel>
-#include <QFile>
-#include <QList>
+#include <QPair>
+#include <QString>
 #include <QVariant>
-#include <QStringList>
-#include <QDebug>
-#include <QMap>
-
-struct TriggerRule {
-    QString vidPid;
-    QString script;
-    QStringList args;
-    bool authRequired;
-    int delaySec;
-};
+#include <QVector>
+#include "core/ruleconfig.h"
 
+// One row per action of the loaded RuleConfig.
 class TriggerModel : public QAbstractTableModel {
     Q_OBJECT
 public:
@@ -27,13 +19,16 @@ public:
     QVariant data(const QModelIndex& index, int role = Qt::DisplayRole) const override;
     QVariant headerData(int section, Qt::Orientation orientation, int role = Qt::DisplayRole) const override;
 
-    void addTrigger(const QString& vidPid, const TriggerRule& rule);
+    void addTrigger(const QString& vidPid, const ActionSpec& action);
     void removeTriggers(const QString& vidPid);
     bool loadTriggers(const QString& filePath);
     bool saveTriggers(const QString& filePath);
     
 private:
-    QList<TriggerRule> m_triggers;
+    void rebuildRows();
+
+    RuleConfig m_config;
+    QVector<QPair<int, int>> m_rows;   // (entry, action)
 };
 
 #endif // TRIGGERMODEL_H
@@ -2,11 +2,10 @@
 #define USBMONITOR_H
 
 #include <QThread>
-#include <QMutex>
-#include <QWaitCondition>
-#include <libudev.h>
-#include <nlohmann/json.hpp>
+#include <atomic>
+#include "core/usbengine.h"
 
+// Runs the core UsbEngine on its own thread and forwards its log to the UI.
 class UsbMonitor : public QThread {
     Q_OBJECT
 public:
@@ -15,25 +14,38 @@ public:
     void stop();
     void resetStopFlag();
     void setConfigPath(const QString& path);
-    void checkExistingDevices();
+    // Processes the devices already plugged in when monitoring starts,
+    // without missing or repeating any (UsbEngine::setColdplug).
+    void setColdplug(bool enabled);
+    // Actions are started by the pre-forked helper (UsbEngine::setSpawner).
+    void setSpawner(Spawner* spawner);
+
+    // Scans the devices already plugged in on a worker thread, so the UI
+    // stays responsive; progress and the result come as signals.
+    void startScan();
+    void cancelScan();
+    bool isScanning() const { return m_scanThread != nullptr; }
+
+    // Devices plugged in while monitoring runs. devicesChanged() is emitted
+    // once until this is called again, however many changes there were.
+    std::vector<AttachedDevice> attachedDevices();
 
 signals:
     void logMessage(const QString& message);
     void started();
     void finished();
+    void scanProgress(int done, int total);
+    void scanFinished(bool completed);
+    void devicesChanged();
 
 protected:
     void run() override;
 
 private:
-    QMutex m_mutex;
-    QWaitCondition m_waitCondition;
-    bool m_stop;
-    QString m_configPath;
-
-    void processDevice(struct udev_device* dev);
-    void executeScript(const QString& script, const QStringList& args, int delay);
-    nlohmann::json loadTriggers() const;
+    UsbEngine m_engine;
+    QThread* m_scanThread = nullptr;
+    std::atomic<bool> m_scanCancel{false};
+    std::atomic<bool> m_devicesDirty{false};
 };
 
 #endif // USBMONITOR_H